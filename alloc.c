@@ -1,181 +1,3270 @@
+#define _GNU_SOURCE // mremap
+#include <errno.h>
 #include <stddef.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "alloc.h"
 #define THRESHOLD_FOR_WORST_FIT 64  
 #define MIN_SPLIT_SIZE 16            
 #define BATCH_SIZE 1024              
 
+/*
+ * Build with -DKU_THREAD_SAFE (and -pthread) to get the thread-safe variant:
+ * KU_NUM_ARENAS independent arenas, each with its own lock and bins. Threads
+ * are handed an arena round-robin on their first call and every block
+ * remembers the arena it came from, so frees go back to the owner.
+ */
+#ifdef KU_THREAD_SAFE
+#include <pthread.h>
+#ifndef KU_NUM_ARENAS
+#define KU_NUM_ARENAS 8
+#endif
+typedef pthread_mutex_t Lock;
+#define LOCK_INIT(lock) pthread_mutex_init((lock), NULL)
+#define LOCK(lock) pthread_mutex_lock(lock)
+#define UNLOCK(lock) pthread_mutex_unlock(lock)
+#else
+#undef KU_NUM_ARENAS
+#define KU_NUM_ARENAS 1
+#undef KU_PER_CPU_CACHE  // with one thread its cache already is per CPU
+typedef char Lock;
+#define LOCK_INIT(lock) ((void)(lock))
+#define LOCK(lock) ((void)(lock))
+#define UNLOCK(lock) ((void)(lock))
+#endif
+
+struct Arena;
+
+/*
+ * Every block starts with a header holding its payload size and is followed
+ * directly by its physical successor. Sizes are multiples of sizeof(Block), so
+ * the low bits of size carry flags: BLOCK_FREE marks a block sitting in a bin
+ * and BLOCK_PREV_FREE says the block in front of it is free. A free block
+ * repeats its size in the last word of its payload (the boundary tag), which
+ * lets its successor find it, and keeps its bin back-link in the first word.
+ */
 typedef struct Block {
     size_t size;
-    struct Block* next;
+    union {
+        struct Block* next;        // next block in the bin while free
+        struct Arena* arena;       // owning arena while allocated
+        struct Block* prevRegion;  // region marker: the arena's previous region
+        size_t slot;               // mapped block: index in mappedBlocks
+    };
 } Block;
 
-static Block* head = NULL;
+#define BLOCK_FREE 1
+#define BLOCK_PREV_FREE 2
+#define BLOCK_MMAPPED 4  // has its own mapping, size covers it up to the page end
+#define BLOCK_ZERO 8     // free block whose payload is zero apart from ZERO_DIRTY_WORDS
+#define BLOCK_FLAGS (sizeof(Block) - 1)
+
+#define BLOCK_SIZE(block) ((block)->size & ~BLOCK_FLAGS)
+#define BLOCK_NEXT(block) ((Block*)((char*)((block) + 1) + BLOCK_SIZE(block)))
+#define BLOCK_FOOTER(block) (((size_t*)BLOCK_NEXT(block))[-1])
+#define BLOCK_PREV(block) ((Block*)((char*)(block) - ((size_t*)(block))[-1] - sizeof(Block)))
+#define FREE_PREV(block) (*(Block**)((block) + 1))
+
+/*
+ * Free blocks are kept in segregated bins. Sizes below SMALL_BIN_LIMIT get one
+ * exact bin per multiple of sizeof(Block), larger sizes share one bin per
+ * power of two. A bitmap records which bins are non-empty so that the next
+ * usable bin is found with a couple of bit scans instead of a list walk.
+ */
+#define SMALL_BIN_LIMIT 512
+#define SMALL_BIN_SHIFT 9 // log2(SMALL_BIN_LIMIT)
+#define NUM_SMALL_BINS (SMALL_BIN_LIMIT / sizeof(Block))
+#define NUM_BINS (NUM_SMALL_BINS + 64 - SMALL_BIN_SHIFT)
+#define BITMAP_WORDS ((NUM_BINS + 63) / 64)
+
+// adaptive placement state for one size range, see bin_take
+#define POLICY_RANGES 4
+#define ADAPT_CANDIDATES 4
+
+typedef struct PolicyRange {
+    unsigned char policy;  // winner of the last round of trials
+    unsigned char trial;   // candidate on trial, ADAPT_CANDIDATES once decided
+    unsigned int periods;  // periods run with the winner
+    unsigned int takes;    // searches in the current period
+    size_t scanned;        // blocks they looked at
+    double scores[ADAPT_CANDIDATES];
+} PolicyRange;
+
+typedef struct Arena {
+    Lock lock;
+    Block* bins[NUM_BINS];
+    unsigned long long binmap[BITMAP_WORDS];
+    Block* fence;  // zero-sized in-use block closing the newest region
+    Block* regions;  // marker opening the newest region, see arena_extend
+    Block* top;    // free block ending at the fence, carved directly and never binned
+    size_t growBytes;  // size of the next extension, doubles up to TOP_GROW_MAX
+    size_t rover;      // bin where the last next-fit search succeeded
+    PolicyRange ranges[POLICY_RANGES];
+    unsigned int freesSinceCheck;
+    unsigned long long lastScavenge;  // ms timestamp of the last decay pass
+#ifdef KU_THREAD_SAFE
+    Block* remoteList;  // blocks freed by threads on other arenas, pushed lock-free
+#endif
+
+    // statistics, guarded by the arena lock like everything else
+    size_t allocs[NUM_BINS];  // kumalloc calls served by the arena itself
+    size_t frees[NUM_BINS];
+    size_t heapBytes;         // sbrk memory owned by the arena, fences included
+    size_t freeBytes;         // payload bytes of free blocks, the top chunk included
+    size_t freeBlocks;
+    size_t fences;            // regions, each costs a marker and a fence
+    size_t splits;
+    size_t coalesces;
+    size_t longestScan;       // most blocks looked at by one bin search
+    size_t remoteFrees;       // blocks that came back through remoteList
+} Arena;
+
+static Arena arenas[KU_NUM_ARENAS];
+
+// sbrk is process wide, so growing the heap has its own lock
+static Lock heapLock;
+// guards the registry of mapped blocks
+static Lock mapLock;
+#ifdef KU_NURSERY
+// guards the nursery's free chunks and reservation
+static Lock nurseryLock;
+#endif
+// guards the registry of thread caches used by the statistics
+static Lock cacheListLock;
+
+// counters not owned by an arena, updated with relaxed atomics
+static struct {
+    size_t sbrkCalls;
+    size_t mmapCalls;
+    size_t mmapBytes;
+    size_t smallBytes;        // slab runs mapped for headerless small objects
+    size_t nurseryBytes;      // nursery chunks committed
+    size_t allocs[NUM_BINS];  // blocks that got their own mapping
+    size_t frees[NUM_BINS];
+} globalStats;
+
+#define STAT_ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+/*
+ * Small-object mode, built with -DKU_SMALL_OBJECTS. Requests of up to
+ * SMALL_OBJECT_LIMIT bytes carry no header: they come from one slab per size
+ * class whose runs are SMALL_RUN_BYTES aligned, and a two-level page map
+ * over those runs tells the size class of any address. kufree looks the
+ * pointer up there first, so it never reads memory in front of an object.
+ */
+#ifdef KU_SMALL_OBJECTS
+#define SMALL_OBJECT_LIMIT 128
+#define SMALL_OBJECT_CLASSES (SMALL_OBJECT_LIMIT / sizeof(Block))
+#define SMALL_RUN_SHIFT 16
+#define SMALL_RUN_BYTES ((size_t)1 << SMALL_RUN_SHIFT)
+
+struct ThreadCache;
+static void pagemap_set(void* start, size_t bytes, unsigned char tag);
+static size_t small_class(const void* ptr);
+static void* small_alloc(size_t index);
+static void small_free(void* ptr, size_t index);
+static void small_drain(struct ThreadCache* cache, size_t index, unsigned int count);
+static void small_init(void);
+static int small_walk(KuHeapWalker walker, void* arg);
+#ifdef KU_THREAD_SAFE
+static void small_lock_all(void);
+static void small_unlock_all(void);
+#endif
+#endif
+
+#ifdef KU_THREAD_SAFE
+static pthread_once_t arenasOnce = PTHREAD_ONCE_INIT;
+static unsigned int nextArena = 0;
+static __thread Arena* threadArena = NULL;
+
+static pthread_key_t tcacheKey;
+static void tcache_flush(void* unused);
+static void tcache_register(void);
+#ifdef KU_PER_CPU_CACHE
+static void cpu_caches_init(void);
+static void cpu_caches_lock_all(void);
+static void cpu_caches_unlock_all(void);
+#endif
+
+static void arenas_init(void) {
+    for (int i = 0; i < KU_NUM_ARENAS; ++i) {
+        LOCK_INIT(&arenas[i].lock);
+    }
+    LOCK_INIT(&heapLock);
+    LOCK_INIT(&mapLock);
+#ifdef KU_NURSERY
+    LOCK_INIT(&nurseryLock);
+#endif
+    LOCK_INIT(&cacheListLock);
+#ifdef KU_SMALL_OBJECTS
+    small_init();
+#endif
+#ifdef KU_PER_CPU_CACHE
+    cpu_caches_init();
+#endif
+    pthread_key_create(&tcacheKey, tcache_flush);
+}
+
+// arena of the calling thread, assigned round-robin on first use
+static Arena* arena_get(void) {
+    if (threadArena == NULL) {
+        pthread_once(&arenasOnce, arenas_init);
+        unsigned int index = __atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED);
+        threadArena = &arenas[index % KU_NUM_ARENAS];
+        // any non-NULL value makes the thread cache flush run at thread exit
+        pthread_setspecific(tcacheKey, threadArena);
+        tcache_register();
+    }
+    return threadArena;
+}
+
+/*
+ * A child of a multithreaded process only keeps the thread that forked, so
+ * every allocator lock is taken around fork and released again on both
+ * sides; otherwise a lock held by another thread would stay held forever in
+ * the child. Registered from a constructor because pthread_atfork itself may
+ * allocate and must not run inside arenas_init.
+ */
+static void arenas_fork_prepare(void) {
+#ifdef KU_PER_CPU_CACHE
+    cpu_caches_lock_all();
+#endif
+#ifdef KU_SMALL_OBJECTS
+    small_lock_all();
+#endif
+    for (int i = 0; i < KU_NUM_ARENAS; ++i) {
+        LOCK(&arenas[i].lock);
+    }
+    LOCK(&heapLock);
+    LOCK(&mapLock);
+#ifdef KU_NURSERY
+    LOCK(&nurseryLock);
+#endif
+    LOCK(&cacheListLock);
+}
+
+static void arenas_fork_release(void) {
+    UNLOCK(&cacheListLock);
+#ifdef KU_NURSERY
+    UNLOCK(&nurseryLock);
+#endif
+    UNLOCK(&mapLock);
+    UNLOCK(&heapLock);
+    for (int i = KU_NUM_ARENAS - 1; i >= 0; --i) {
+        UNLOCK(&arenas[i].lock);
+    }
+#ifdef KU_SMALL_OBJECTS
+    small_unlock_all();
+#endif
+#ifdef KU_PER_CPU_CACHE
+    cpu_caches_unlock_all();
+#endif
+}
+
+__attribute__((constructor)) static void arenas_fork_register(void) {
+    pthread_once(&arenasOnce, arenas_init);
+    pthread_atfork(arenas_fork_prepare, arenas_fork_release, arenas_fork_release);
+}
+#else
+static Arena* arena_get(void) {
+    return &arenas[0];
+}
+#endif
+
+static size_t bin_index(size_t size) {
+    if (size < SMALL_BIN_LIMIT) {
+        return size / sizeof(Block) - 1;
+    }
+    size_t log2 = 63 - __builtin_clzll((unsigned long long)size);
+    return NUM_SMALL_BINS + log2 - SMALL_BIN_SHIFT;
+}
+
+static void bin_push(Arena* arena, Block* block) {
+    size_t index = bin_index(BLOCK_SIZE(block));
+    block->next = arena->bins[index];
+    FREE_PREV(block) = NULL;
+    if (block->next) {
+        FREE_PREV(block->next) = block;
+    }
+    arena->bins[index] = block;
+    arena->binmap[index / 64] |= 1ULL << (index % 64);
+    arena->freeBytes += BLOCK_SIZE(block);
+    arena->freeBlocks++;
+}
+
+// unlink a free block from its bin in constant time
+static void bin_remove(Arena* arena, Block* block) {
+    size_t index = bin_index(BLOCK_SIZE(block));
+    Block* prev = FREE_PREV(block);
+    if (prev) {
+        prev->next = block->next;
+    } else {
+        arena->bins[index] = block->next;
+    }
+    if (block->next) {
+        FREE_PREV(block->next) = prev;
+    }
+    if (arena->bins[index] == NULL) {
+        arena->binmap[index / 64] &= ~(1ULL << (index % 64));
+    }
+    arena->freeBytes -= BLOCK_SIZE(block);
+    arena->freeBlocks--;
+}
+
+// unlink a free block from its bin, or take it as the arena's top chunk
+static void free_unlink(Arena* arena, Block* block) {
+    if (block != arena->top) {
+        bin_remove(arena, block);
+        return;
+    }
+    arena->top = NULL;
+    arena->freeBytes -= BLOCK_SIZE(block);
+    arena->freeBlocks--;
+}
+
+// first non-empty bin with index >= from, or NUM_BINS if there is none
+static size_t bin_next_nonempty(Arena* arena, size_t from) {
+    for (size_t word = from / 64; word < BITMAP_WORDS; ++word) {
+        unsigned long long bits = arena->binmap[word];
+        if (word == from / 64) {
+            bits &= ~0ULL << (from % 64);
+        }
+        if (bits) {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return NUM_BINS;
+}
+
+// highest non-empty bin, or NUM_BINS if every bin is empty
+static size_t bin_last_nonempty(Arena* arena) {
+    for (size_t word = BITMAP_WORDS; word-- > 0;) {
+        if (arena->binmap[word]) {
+            return word * 64 + 63 - __builtin_clzll(arena->binmap[word]);
+        }
+    }
+    return NUM_BINS;
+}
+
+/*
+ * Placement policies. Each one picks a free block of at least size bytes
+ * without unlinking it and counts the blocks it looked at in *scanned; the
+ * searches use the bin bitmap to skip empty bins and give up after
+ * POLICY_SCAN_LIMIT blocks. A block in a bin above the request's own is
+ * always big enough, a block in its own power-of-two bin may not be.
+ *
+ *   hybrid    first-fit below THRESHOLD_FOR_WORST_FIT, worst-fit above (default)
+ *   first     first fitting block of the lowest bin that has one
+ *   next      first-fit starting at the bin of the previous success
+ *   best      smallest fitting block of the lowest bin that has one
+ *   worst     largest block of the highest bin
+ *   address   lowest-addressed fitting block
+ *   good      first block wasting at most 1/GOOD_FIT_SLACK, else the best seen
+ *   adaptive  picks one of the above per size range, see policy_sample
+ *
+ * The policy is set with kumalloc_set_policy or KUMALLOC_POLICY at startup.
+ */
+#define POLICY_SCAN_LIMIT 64
+#define GOOD_FIT_SLACK 8
+
+typedef Block* (*Placement)(Arena* arena, size_t size, size_t* scanned);
+
+// first fitting block in bin index or above
+static Block* first_fit_from(Arena* arena, size_t size, size_t index, size_t* scanned) {
+    if (index == bin_index(size) && index >= NUM_SMALL_BINS) {
+        for (Block* block = arena->bins[index]; block != NULL && *scanned < POLICY_SCAN_LIMIT; block = block->next) {
+            ++*scanned;
+            if (BLOCK_SIZE(block) >= size) {
+                return block;
+            }
+        }
+        index++;
+    }
+    size_t found = bin_next_nonempty(arena, index);
+    if (found == NUM_BINS) {
+        return NULL;
+    }
+    ++*scanned;
+    return arena->bins[found];
+}
+
+static Block* place_first(Arena* arena, size_t size, size_t* scanned) {
+    return first_fit_from(arena, size, bin_index(size), scanned);
+}
+
+static Block* place_next(Arena* arena, size_t size, size_t* scanned) {
+    size_t index = bin_index(size);
+    Block* block = NULL;
+    if (arena->rover > index) {
+        block = first_fit_from(arena, size, arena->rover, scanned);
+    }
+    if (block == NULL) {
+        block = first_fit_from(arena, size, index, scanned);
+    }
+    if (block != NULL) {
+        arena->rover = bin_index(BLOCK_SIZE(block));
+    }
+    return block;
+}
+
+// smallest fitting block of bin index, NULL if it has none
+static Block* best_in_bin(Arena* arena, size_t size, size_t index, size_t* scanned) {
+    Block* best = NULL;
+    for (Block* block = arena->bins[index]; block != NULL && *scanned < POLICY_SCAN_LIMIT; block = block->next) {
+        ++*scanned;
+        if (BLOCK_SIZE(block) >= size && (best == NULL || BLOCK_SIZE(block) < BLOCK_SIZE(best))) {
+            best = block;
+            if (BLOCK_SIZE(best) == size || index < NUM_SMALL_BINS) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+static Block* place_best(Arena* arena, size_t size, size_t* scanned) {
+    for (size_t index = bin_next_nonempty(arena, bin_index(size)); index < NUM_BINS;
+         index = bin_next_nonempty(arena, index + 1)) {
+        Block* block = best_in_bin(arena, size, index, scanned);
+        if (block != NULL) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static Block* place_worst(Arena* arena, size_t size, size_t* scanned) {
+    size_t index = bin_last_nonempty(arena);
+    if (index == NUM_BINS || index < bin_index(size)) {
+        return NULL;
+    }
+    Block* worst = NULL;
+    for (Block* block = arena->bins[index]; block != NULL && *scanned < POLICY_SCAN_LIMIT; block = block->next) {
+        ++*scanned;
+        if (BLOCK_SIZE(block) >= size && (worst == NULL || BLOCK_SIZE(block) > BLOCK_SIZE(worst))) {
+            worst = block;
+        }
+    }
+    return worst;
+}
+
+static Block* place_address(Arena* arena, size_t size, size_t* scanned) {
+    Block* lowest = NULL;
+    for (size_t index = bin_next_nonempty(arena, bin_index(size));
+         index < NUM_BINS && *scanned < POLICY_SCAN_LIMIT;
+         index = bin_next_nonempty(arena, index + 1)) {
+        for (Block* block = arena->bins[index]; block != NULL && *scanned < POLICY_SCAN_LIMIT; block = block->next) {
+            ++*scanned;
+            if (BLOCK_SIZE(block) >= size && (lowest == NULL || block < lowest)) {
+                lowest = block;
+            }
+        }
+    }
+    return lowest;
+}
+
+static Block* place_good(Arena* arena, size_t size, size_t* scanned) {
+    Block* best = NULL;
+    for (size_t index = bin_next_nonempty(arena, bin_index(size));
+         index < NUM_BINS && *scanned < POLICY_SCAN_LIMIT;
+         index = bin_next_nonempty(arena, index + 1)) {
+        for (Block* block = arena->bins[index]; block != NULL && *scanned < POLICY_SCAN_LIMIT; block = block->next) {
+            ++*scanned;
+            if (BLOCK_SIZE(block) < size) {
+                continue;
+            }
+            if (BLOCK_SIZE(block) - size <= size / GOOD_FIT_SLACK) {
+                return block;
+            }
+            if (best == NULL || BLOCK_SIZE(block) < BLOCK_SIZE(best)) {
+                best = block;
+            }
+        }
+        if (best != NULL) {
+            return best;  // higher bins only hold bigger blocks
+        }
+    }
+    return best;
+}
+
+/*
+ * Small requests use first-fit: the exact bin, else the head of the next
+ * non-empty bin, both O(1). Requests of THRESHOLD_FOR_WORST_FIT bytes or more
+ * use worst-fit approximated by the highest non-empty bin; only when that bin
+ * is the request's own power-of-two bin does it need a scan, bounded by
+ * POLICY_SCAN_LIMIT like every other placement.
+ */
+static Block* place_hybrid(Arena* arena, size_t size, size_t* scanned) {
+    size_t index = bin_index(size);
+    size_t found;
+
+    if (size < THRESHOLD_FOR_WORST_FIT) {
+        found = bin_next_nonempty(arena, index);
+    } else {
+        found = bin_last_nonempty(arena);
+        if (found == NUM_BINS || found < index) {
+            return NULL;
+        }
+    }
+    if (found == NUM_BINS) {
+        return NULL;
+    }
+
+    if (found > index || found < NUM_SMALL_BINS) {
+        // every block in a higher bin (or an exact bin) is large enough
+        ++*scanned;
+        return arena->bins[found];
+    }
+
+    // blocks in the request's own power-of-two bin may still be too small
+    for (Block* current = arena->bins[found]; current != NULL && *scanned < POLICY_SCAN_LIMIT;
+         current = current->next) {
+        ++*scanned;
+        if (BLOCK_SIZE(current) >= size) {
+            return current;
+        }
+    }
+    // any block of a higher bin fits; for worst-fit there is none
+    found = bin_next_nonempty(arena, found + 1);
+    if (found == NUM_BINS) {
+        return NULL;
+    }
+    ++*scanned;
+    return arena->bins[found];
+}
+
+static const Placement placements[] = {
+    [KU_POLICY_HYBRID] = place_hybrid,
+    [KU_POLICY_FIRST] = place_first,
+    [KU_POLICY_NEXT] = place_next,
+    [KU_POLICY_BEST] = place_best,
+    [KU_POLICY_WORST] = place_worst,
+    [KU_POLICY_ADDRESS] = place_address,
+    [KU_POLICY_GOOD] = place_good,
+};
+
+static const char* const policyNames[] = {
+    [KU_POLICY_HYBRID] = "hybrid",
+    [KU_POLICY_FIRST] = "first",
+    [KU_POLICY_NEXT] = "next",
+    [KU_POLICY_BEST] = "best",
+    [KU_POLICY_WORST] = "worst",
+    [KU_POLICY_ADDRESS] = "address",
+    [KU_POLICY_GOOD] = "good",
+    [KU_POLICY_ADAPTIVE] = "adaptive",
+};
+
+static KuPolicy placementPolicy = KU_POLICY_HYBRID;
+
+int kumalloc_set_policy(KuPolicy policy) {
+    if ((unsigned int)policy > KU_POLICY_ADAPTIVE) {
+        return -1;
+    }
+    __atomic_store_n(&placementPolicy, policy, __ATOMIC_RELAXED);
+    return 0;
+}
+
+__attribute__((constructor)) static void policy_from_env(void) {
+    const char* value = getenv("KUMALLOC_POLICY");
+    for (int policy = 0; value != NULL && policy <= KU_POLICY_ADAPTIVE; ++policy) {
+        if (strcmp(value, policyNames[policy]) == 0) {
+            kumalloc_set_policy((KuPolicy)policy);
+        }
+    }
+}
+
+/*
+ * Adaptive placement. Requests are split into POLICY_RANGES size ranges and
+ * each range of each arena runs its own trials: every candidate policy
+ * serves ADAPT_PERIOD searches and is scored by the arena's fragmentation
+ * at the end of its period plus its average scan length, weighted so that
+ * ADAPT_SCAN_COST blocks per search cost as much as all free memory being
+ * scattered. The lowest score then serves the range for ADAPT_EXPLOIT
+ * periods before the next round, so the choice follows the workload.
+ */
+#define ADAPT_PERIOD 1024
+#define ADAPT_EXPLOIT 32
+#define ADAPT_SCAN_COST 64.0
+
+static const KuPolicy adaptCandidates[ADAPT_CANDIDATES] = {
+    KU_POLICY_FIRST, KU_POLICY_BEST, KU_POLICY_WORST, KU_POLICY_GOOD,
+};
+
+static size_t arena_largest_free(Arena* arena);
+
+// below 64 bytes, below SMALL_BIN_LIMIT, below 4 KiB and the rest
+static size_t policy_range(size_t size) {
+    return (size >= THRESHOLD_FOR_WORST_FIT) + (size >= SMALL_BIN_LIMIT) + (size >= 4096);
+}
+
+static KuPolicy range_policy(PolicyRange* range) {
+    return range->trial < ADAPT_CANDIDATES ? adaptCandidates[range->trial] : (KuPolicy)range->policy;
+}
+
+static void policy_sample(Arena* arena, PolicyRange* range, size_t scanned) {
+    range->scanned += scanned;
+    if (++range->takes < ADAPT_PERIOD) {
+        return;
+    }
+    double fragmentation = arena->freeBytes ? 1.0 - (double)arena_largest_free(arena) / arena->freeBytes : 0.0;
+    double score = fragmentation + (double)range->scanned / range->takes / ADAPT_SCAN_COST;
+    range->takes = 0;
+    range->scanned = 0;
+
+    if (range->trial < ADAPT_CANDIDATES) {
+        range->scores[range->trial++] = score;
+        if (range->trial == ADAPT_CANDIDATES) {
+            size_t winner = 0;
+            for (size_t i = 1; i < ADAPT_CANDIDATES; ++i) {
+                if (range->scores[i] < range->scores[winner]) {
+                    winner = i;
+                }
+            }
+            range->policy = (unsigned char)adaptCandidates[winner];
+            range->periods = 0;
+        }
+    } else if (++range->periods >= ADAPT_EXPLOIT) {
+        range->trial = 0;
+    }
+}
+
+// pick a free block of at least size bytes with the current policy and
+// unlink it, the arena lock must be held
+static Block* bin_take(Arena* arena, size_t size) {
+    KuPolicy policy = __atomic_load_n(&placementPolicy, __ATOMIC_RELAXED);
+    PolicyRange* range = NULL;
+    if (policy == KU_POLICY_ADAPTIVE) {
+        range = &arena->ranges[policy_range(size)];
+        policy = range_policy(range);
+    }
+    size_t scanned = 0;
+    Block* block = placements[policy](arena, size, &scanned);
+    if (block == NULL) {
+        // a search cut short by the scan limit must not grow the heap
+        size_t found = bin_next_nonempty(arena, bin_index(size) + 1);
+        block = found < NUM_BINS ? arena->bins[found] : NULL;
+    }
+    if (block != NULL) {
+        bin_remove(arena, block);
+    }
+    if (scanned > arena->longestScan) {
+        arena->longestScan = scanned;
+    }
+    if (range != NULL) {
+        policy_sample(arena, range, scanned);
+    }
+    return block;
+}
+
+static size_t page_size(void) {
+    static size_t pageSize = 0;
+    if (pageSize == 0) {
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return pageSize;
+}
+
+static unsigned long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Free blocks of at least SCAVENGE_MIN_SPAN bytes are candidates for the
+ * scavenger. Next to the bin back-link they record when they became free and
+ * whether their interior pages were already handed back to the OS.
+ */
+#define SCAVENGE_MIN_SPAN (8 * 1024)
+#define SPAN_FREED_AT(block) (((unsigned long long*)((block) + 1))[1])
+#define SPAN_RELEASED(block) (((unsigned long long*)((block) + 1))[2])
+
+/*
+ * A BLOCK_ZERO block is known to hold zeroes except for the bookkeeping words
+ * above (bin link, span fields) at the front and the boundary tag at the end.
+ * Only memory fresh from the OS starts out that way and the flag survives
+ * splits and merges between zero blocks, it is dropped once a block is handed
+ * out. kucalloc then only has to clear those few words.
+ */
+#define ZERO_DIRTY_BYTES (3 * sizeof(unsigned long long))
+
+static void arena_free(Arena* arena, Block* blockToFree);
+
+// mark block free, write its boundary tag and put it in its bin, or make
+// it the top chunk when it ends at the fence
+static void block_release(Arena* arena, Block* block) {
+    block->size |= BLOCK_FREE;
+    BLOCK_FOOTER(block) = BLOCK_SIZE(block);
+    BLOCK_NEXT(block)->size |= BLOCK_PREV_FREE;
+    if (BLOCK_SIZE(block) >= SCAVENGE_MIN_SPAN) {
+        SPAN_FREED_AT(block) = now_ms();
+        SPAN_RELEASED(block) = 0;
+    }
+    if (BLOCK_NEXT(block) != arena->fence) {
+        bin_push(arena, block);
+        return;
+    }
+    arena->top = block;
+    arena->freeBytes += BLOCK_SIZE(block);
+    arena->freeBlocks++;
+}
+
+/*
+ * Huge-page mode, built with -DKU_HUGE_PAGES. The arenas grow out of an
+ * address range reserved up front instead of the program break, committed
+ * HUGE_REGION at a time on HUGE_REGION boundaries, so the heap can be backed
+ * by 2 MiB pages and a walk over it needs far fewer TLB entries. A region is
+ * committed with MAP_HUGETLB while the administrator's huge page pool lasts
+ * and otherwise made accessible with normal pages and marked MADV_HUGEPAGE
+ * for transparent huge pages. heap_grow bumps through the reservation, so
+ * consecutive extensions of one arena stay contiguous and merge like they
+ * do under the program break.
+ */
+#ifdef KU_HUGE_PAGES
+#define HUGE_REGION ((size_t)2 * 1024 * 1024)
+#define HUGE_RESERVE ((size_t)1024 * 1024 * 1024)  // address space only
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0  // older headers, the address is only a hint then
+#endif
+
+// bump pointer, end of the committed part and end of the reservation,
+// guarded by heapLock
+static char* hugeNext = NULL;
+static char* hugeCommitted = NULL;
+static char* hugeEnd = NULL;
+static int hugetlbUsable = 1;  // cleared once MAP_HUGETLB fails
+
+// start a new HUGE_REGION aligned reservation of at least bytes
+static int huge_reserve(size_t bytes) {
+    size_t length = (bytes + HUGE_REGION - 1) & ~(HUGE_REGION - 1);
+    if (length < HUGE_RESERVE) {
+        length = HUGE_RESERVE;
+    }
+    char* mapped = mmap(NULL, length + HUGE_REGION, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    // cut off the misaligned ends
+    char* start = (char*)(((uintptr_t)mapped + HUGE_REGION - 1) & ~(uintptr_t)(HUGE_REGION - 1));
+    if (start > mapped) {
+        munmap(mapped, start - mapped);
+    }
+    munmap(start + length, mapped + HUGE_REGION - start);
+    // the uncommitted rest of the old reservation is never used
+    if (hugeCommitted < hugeEnd) {
+        munmap(hugeCommitted, hugeEnd - hugeCommitted);
+    }
+    hugeNext = hugeCommitted = start;
+    hugeEnd = start + length;
+    return 1;
+}
+
+// make length reserved bytes at memory usable, returns 0 on failure
+static int huge_commit(char* memory, size_t length) {
+#ifdef MAP_HUGETLB
+    if (hugetlbUsable) {
+        if (mmap(memory, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED) {
+            return 1;
+        }
+        hugetlbUsable = 0;
+        // a failed MAP_FIXED may already have unmapped the reservation there
+        char* refill = mmap(memory, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (refill == memory) {
+            madvise(memory, length, MADV_HUGEPAGE);
+            return 1;
+        }
+        if (refill != MAP_FAILED) {
+            munmap(refill, length);
+        }
+    }
+#endif
+    if (mprotect(memory, length, PROT_READ | PROT_WRITE) != 0) {
+        return 0;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(memory, length, MADV_HUGEPAGE);
+#endif
+    return 1;
+}
+#endif
+
+// get bytes more memory from the OS, 16-byte aligned, NULL if there is none
+static char* heap_grow(size_t bytes) {
+    LOCK(&heapLock);
+#ifdef KU_HUGE_PAGES
+    if ((size_t)(hugeEnd - hugeNext) < bytes) {
+        if (bytes > SIZE_MAX - 2 * HUGE_REGION || !huge_reserve(bytes)) {
+            UNLOCK(&heapLock);
+            return NULL;
+        }
+    }
+    if ((size_t)(hugeCommitted - hugeNext) < bytes) {
+        size_t length = (hugeNext + bytes - hugeCommitted + HUGE_REGION - 1) & ~(HUGE_REGION - 1);
+        if (!huge_commit(hugeCommitted, length)) {
+            UNLOCK(&heapLock);
+            return NULL;
+        }
+        hugeCommitted += length;
+        STAT_ADD(globalStats.mmapCalls, 1);
+    }
+    char* chunk = hugeNext;
+    hugeNext += bytes;
+    UNLOCK(&heapLock);
+    return chunk;
+#else
+    // someone else may have moved the break to an unaligned address
+    size_t pad = -(size_t)sbrk(0) & (sizeof(Block) - 1);
+    char* memory = sbrk(pad + bytes);
+    globalStats.sbrkCalls++;
+    UNLOCK(&heapLock);
+    if (memory == (void*)-1) {
+        return NULL; // sbrk failed
+    }
+    return memory + pad;
+#endif
+}
+
+/*
+ * Add at least size bytes of free space to arena. Each region obtained from
+ * sbrk ends in a fence block so coalescing never walks into memory owned by
+ * another arena or by someone else's sbrk. When the new region lands right
+ * after the arena's current fence the fence turns into the new block's
+ * header, so contiguous growth merges into the top chunk.
+ *
+ * A region that does not continue the last one also starts with a zero-sized
+ * marker linking back to the arena's previous region, which is all
+ * kuheap_walk needs to find every block.
+ *
+ * The top chunk (the wilderness) is the free block in front of the fence.
+ * It stays out of the bins and is carved only once no binned block fits, so
+ * fresh memory is used front to back instead of being scattered. Extensions
+ * start at BATCH_SIZE and double up to TOP_GROW_MAX, which makes a stream of
+ * allocations cost a logarithmic number of sbrk calls until the cap.
+ */
+#define TOP_GROW_MAX (16 * 1024 * 1024)
+#define REGION_OVERHEAD (3 * sizeof(Block))  // marker, header and fence
+
+static int arena_extend(Arena* arena, size_t size) {
+    if (arena->growBytes < BATCH_SIZE) {
+        arena->growBytes = BATCH_SIZE;
+    }
+    // overhead included, so extensions tile the heap in powers of two
+    while (arena->growBytes - REGION_OVERHEAD < size && arena->growBytes < TOP_GROW_MAX) {
+        arena->growBytes *= 2;
+    }
+    size_t allocSize = arena->growBytes - REGION_OVERHEAD;
+    if (allocSize < size) {
+        allocSize = size;
+    }
+    char* memory = heap_grow(allocSize + REGION_OVERHEAD);
+    if (memory == NULL) {
+        return 0;
+    }
+    char* end = memory + allocSize + REGION_OVERHEAD;
+    if (arena->growBytes < TOP_GROW_MAX) {
+        arena->growBytes *= 2;
+    }
+
+    Block* block;
+    size_t flags = 0;
+    if (arena->fence && memory == (char*)(arena->fence + 1)) {
+        block = arena->fence;
+        flags = block->size & BLOCK_PREV_FREE;
+    } else {
+        Block* marker = (Block*)memory;
+        marker->size = 0;
+        marker->prevRegion = arena->regions;
+        arena->regions = marker;
+        block = marker + 1;
+        arena->fences++;
+        // the old top no longer ends at the fence, it becomes an ordinary free block
+        Block* top = arena->top;
+        if (top != NULL) {
+            free_unlink(arena, top);
+            bin_push(arena, top);
+        }
+    }
+    arena->heapBytes += end - memory;
+    Block* fence = (Block*)(end - sizeof(Block));
+    fence->size = 0;
+    fence->arena = arena;
+    arena->fence = fence;
+
+    // pages past the old break are fresh from the kernel, only the part of
+    // the first page below it may hold stale data from an earlier break
+    char* payload = (char*)(block + 1);
+    char* fresh = (char*)(((uintptr_t)memory + page_size() - 1) & ~(uintptr_t)(page_size() - 1));
+    if (fresh > (char*)fence) {
+        fresh = (char*)fence;
+    }
+    if (fresh > payload) {
+        memset(payload, 0, fresh - payload);
+    }
+
+    block->size = ((char*)fence - payload) | flags | BLOCK_ZERO;
+    block->arena = arena;
+    arena_free(arena, block);
+    return 1;
+}
+
+/*
+ * Requests of at least mmapThreshold bytes bypass the arenas and get their
+ * own anonymous mapping, which kufree hands straight back with munmap. The
+ * program break only shrinks from the top, so these are exactly the buffers
+ * that would otherwise stay pinned under a later small allocation.
+ */
+#define MMAP_THRESHOLD (128 * 1024)
+
+static size_t mmapThreshold = MMAP_THRESHOLD;
+
+void kumalloc_set_mmap_threshold(size_t bytes) {
+    // anything smaller would collide with the thread cache size classes
+    mmapThreshold = bytes < SMALL_BIN_LIMIT ? SMALL_BIN_LIMIT : bytes;
+}
+
+// start of the mapping holding block, an aligned block may begin inside it
+#define MMAP_BASE(block) ((char*)((uintptr_t)(block) & ~(uintptr_t)(page_size() - 1)))
+
+/*
+ * Mapped blocks are listed in mappedBlocks so kuheap_walk can find them.
+ * Each header keeps its slot and removal moves the last entry into the gap,
+ * which rewrites that block's header, so mremap runs under mapLock as well.
+ * The array lives in its own mapping, never in the heap it describes.
+ */
+static Block** mappedBlocks;
+static size_t mappedCount;
+static size_t mappedCapacity;
+
+static int mapped_add(Block* block) {
+    LOCK(&mapLock);
+    if (mappedCount == mappedCapacity) {
+        size_t oldBytes = mappedCapacity * sizeof(Block*);
+        size_t bytes = oldBytes ? oldBytes * 2 : page_size();
+        void* grown = oldBytes
+            ? mremap(mappedBlocks, oldBytes, bytes, MREMAP_MAYMOVE)
+            : mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (grown == MAP_FAILED) {
+            UNLOCK(&mapLock);
+            return 0;
+        }
+        mappedBlocks = grown;
+        mappedCapacity = bytes / sizeof(Block*);
+    }
+    block->slot = mappedCount;
+    mappedBlocks[mappedCount++] = block;
+    UNLOCK(&mapLock);
+    return 1;
+}
+
+static void mapped_remove(Block* block) {
+    LOCK(&mapLock);
+    Block* last = mappedBlocks[--mappedCount];
+    last->slot = block->slot;
+    mappedBlocks[block->slot] = last;
+    UNLOCK(&mapLock);
+}
+
+static Block* mmap_alloc(size_t size) {
+    size_t pageMask = page_size() - 1;
+    if (size > SIZE_MAX - sizeof(Block) - pageMask) {
+        return NULL;
+    }
+    size_t length = (size + sizeof(Block) + pageMask) & ~pageMask;
+    Block* block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        return NULL;
+    }
+    block->size = (length - sizeof(Block)) | BLOCK_MMAPPED;
+    if (!mapped_add(block)) {
+        munmap(block, length);
+        return NULL;
+    }
+    STAT_ADD(globalStats.mmapCalls, 1);
+    STAT_ADD(globalStats.mmapBytes, length);
+    STAT_ADD(globalStats.allocs[bin_index(size)], 1);
+    return block;
+}
+
+/*
+ * Mapping whose payload is aligned to align, a power of two above
+ * sizeof(Block). Whole pages in front of the header's page and past the
+ * payload are unmapped again right away.
+ */
+static Block* mmap_alloc_aligned(size_t align, size_t size) {
+    size_t pageMask = page_size() - 1;
+    if (align > SIZE_MAX / 2 || size > SIZE_MAX - sizeof(Block) - align - pageMask) {
+        return NULL;
+    }
+    size_t span = (size + sizeof(Block) + align + pageMask) & ~pageMask;
+    char* memory = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    char* payload = (char*)(((uintptr_t)memory + sizeof(Block) + align - 1) & ~(uintptr_t)(align - 1));
+    Block* block = (Block*)payload - 1;
+    char* base = MMAP_BASE(block);
+    char* end = (char*)(((uintptr_t)payload + size + pageMask) & ~(uintptr_t)pageMask);
+    if (base > memory) {
+        munmap(memory, base - memory);
+    }
+    if (memory + span > end) {
+        munmap(end, memory + span - end);
+    }
+    block->size = (end - payload) | BLOCK_MMAPPED;
+    if (!mapped_add(block)) {
+        munmap(base, end - base);
+        return NULL;
+    }
+    STAT_ADD(globalStats.mmapCalls, 1);
+    STAT_ADD(globalStats.mmapBytes, end - base);
+    STAT_ADD(globalStats.allocs[bin_index(size)], 1);
+    return block;
+}
+
+static void mmap_free(Block* block) {
+    char* base = MMAP_BASE(block);
+    size_t length = (char*)BLOCK_NEXT(block) - base;
+    mapped_remove(block);
+    STAT_ADD(globalStats.mmapBytes, -length);
+    STAT_ADD(globalStats.frees[bin_index(BLOCK_SIZE(block))], 1);
+    munmap(base, length);
+}
+
+// cut an in-use block down to size bytes and free the tail if it is big
+// enough to be a block of its own, the arena lock must be held
+static void block_split(Arena* arena, Block* block, size_t size) {
+    if (BLOCK_SIZE(block) > size + MIN_SPLIT_SIZE) {
+        Block* remainingBlock = (Block*)((char*)block + sizeof(Block) + size);
+        remainingBlock->size = (BLOCK_SIZE(block) - size - sizeof(Block)) | (block->size & BLOCK_ZERO);
+        block->size = size | (block->size & (BLOCK_PREV_FREE | BLOCK_ZERO));
+        arena->splits++;
+        arena_free(arena, remainingBlock);
+    }
+}
+
+/*
+ * Cross-thread frees. A thread freeing a block that belongs to another
+ * arena never takes that arena's lock: it pushes the block (or a chain of
+ * them) onto the arena's remoteList with a compare-and-swap, linked through
+ * the first payload word. The owner swaps the whole list out and frees it
+ * under its own lock the next time it allocates or scavenges. Taking the
+ * entire list at once is what keeps the single consumer free of ABA.
+ */
+#ifdef KU_THREAD_SAFE
+#define REMOTE_LINK(block) (*(Block**)((block) + 1))
+
+// push the chain first..last, already linked through REMOTE_LINK
+static void remote_push(Arena* arena, Block* first, Block* last) {
+    Block* head = __atomic_load_n(&arena->remoteList, __ATOMIC_RELAXED);
+    do {
+        REMOTE_LINK(last) = head;
+    } while (!__atomic_compare_exchange_n(&arena->remoteList, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// the arena lock must be held
+static void arena_drain_remote(Arena* arena) {
+    if (__atomic_load_n(&arena->remoteList, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+    Block* block = __atomic_exchange_n(&arena->remoteList, NULL, __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        Block* next = REMOTE_LINK(block);
+        arena->remoteFrees++;
+        arena_free(arena, block);
+        block = next;
+    }
+}
+#else
+#define arena_drain_remote(arena) ((void)(arena))
+#endif
+
+// carve a block of size bytes out of arena, *zero (if not NULL) tells whether
+// it came out of known-zero memory, the arena lock must be held
+static Block* arena_malloc(Arena* arena, size_t size, int* zero) {
+    arena_drain_remote(arena);
+    Block* bestBlock = bin_take(arena, size);
+
+    // carve the top chunk if no binned block fits, growing it if it is too small
+    if (bestBlock == NULL) {
+        if ((arena->top == NULL || BLOCK_SIZE(arena->top) < size) && !arena_extend(arena, size)) {
+            return NULL;
+        }
+        bestBlock = arena->top;
+        free_unlink(arena, bestBlock);
+    }
+
+    bestBlock->size &= ~BLOCK_FREE;
+    BLOCK_NEXT(bestBlock)->size &= ~BLOCK_PREV_FREE;
+    bestBlock->arena = arena;
+    block_split(arena, bestBlock, size);
+    if (zero) {
+        *zero = (bestBlock->size & BLOCK_ZERO) != 0;
+    }
+    bestBlock->size &= ~BLOCK_ZERO;
+    return bestBlock;
+}
+
+// zero state of first merged with its physical successor second: both must
+// be zero and the bookkeeping words that end up inside the merged payload
+// are cleared, call before either size changes
+static size_t zero_merge(Block* first, Block* second, size_t zero) {
+    if (!(zero & BLOCK_ZERO) || !(second->size & BLOCK_ZERO)) {
+        return 0;
+    }
+    size_t secondDirty = BLOCK_SIZE(second) < ZERO_DIRTY_BYTES ? BLOCK_SIZE(second) : ZERO_DIRTY_BYTES;
+    char* start = (char*)&BLOCK_FOOTER(first);
+    memset(start, 0, (char*)(second + 1) + secondDirty - start);
+    return BLOCK_ZERO;
+}
+
+// give block back to arena merging it with free neighbours, the arena lock
+// must be held
+static void arena_free(Arena* arena, Block* blockToFree) {
+    Block* next = BLOCK_NEXT(blockToFree);
+    size_t size = BLOCK_SIZE(blockToFree);
+    size_t zero = blockToFree->size & BLOCK_ZERO;
+
+    // coalesce with next block if possible
+    if (next->size & BLOCK_FREE) {
+        free_unlink(arena, next);
+        zero = zero_merge(blockToFree, next, zero);
+        size += sizeof(Block) + BLOCK_SIZE(next);
+        arena->coalesces++;
+    }
+    // coalesce with previous block if possible
+    if (blockToFree->size & BLOCK_PREV_FREE) {
+        Block* prev = BLOCK_PREV(blockToFree);
+        free_unlink(arena, prev);
+        zero = zero_merge(prev, blockToFree, zero & prev->size);
+        size += sizeof(Block) + BLOCK_SIZE(prev);
+        arena->coalesces++;
+        blockToFree = prev;
+    }
+
+    blockToFree->size = size | (blockToFree->size & BLOCK_PREV_FREE) | zero;
+    block_release(arena, blockToFree);
+}
+
+/*
+ * Decay-based scavenger. Free spans that stayed idle for scavengeIntervalMs
+ * get their whole interior pages dropped with madvise (the header, bin links
+ * and boundary tag stay resident) and a free block at the top of the heap is
+ * given back with a negative sbrk. A pass runs from the free path at most
+ * once per interval, from kumalloc_trim, and in thread-safe builds from a
+ * background thread once kumalloc_set_scavenge_interval has been called.
+ * Build with -DKU_SCAVENGE_MADV_FREE to let the kernel reclaim lazily instead.
+ */
+#define SCAVENGE_INTERVAL_MS 1000
+#define SCAVENGE_CHECK_EVERY 64
+#define TOP_PAD (64 * 1024)
+
+#ifdef KU_SCAVENGE_MADV_FREE
+#define SCAVENGE_ADVICE MADV_FREE
+#else
+#define SCAVENGE_ADVICE MADV_DONTNEED
+#endif
+
+static unsigned int scavengeIntervalMs = SCAVENGE_INTERVAL_MS;
+static KuScavengeStats scavengeStats;
+
+static int span_idle(Block* block, unsigned long long now, unsigned long long idleMs) {
+    return BLOCK_SIZE(block) >= SCAVENGE_MIN_SPAN && !SPAN_RELEASED(block)
+        && now - SPAN_FREED_AT(block) >= idleMs;
+}
+
+// drop the interior pages of a free span, returns the number of bytes
+static size_t span_release(Block* block) {
+    size_t pageMask = page_size() - 1;
+    uintptr_t start = ((uintptr_t)&SPAN_RELEASED(block) + sizeof(unsigned long long) + pageMask) & ~pageMask;
+    uintptr_t end = (uintptr_t)&BLOCK_FOOTER(block) & ~pageMask;
+    SPAN_RELEASED(block) = 1;
+    if (end <= start || madvise((void*)start, end - start, SCAVENGE_ADVICE) != 0) {
+        return 0;
+    }
+    return end - start;
+}
+
+// shrink the break if the arena's last free block ends at it, keeping pad bytes
+static size_t arena_trim_top(Arena* arena, size_t pad) {
+#ifdef KU_HUGE_PAGES
+    (void)arena;
+    (void)pad;
+    return 0; // the arenas live in regions, not under the break
+#endif
+    Block* fence = arena->fence;
+    if (fence == NULL || !(fence->size & BLOCK_PREV_FREE)) {
+        return 0;
+    }
+    Block* last = BLOCK_PREV(fence);
+    size_t keep = (pad + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+    if (keep < sizeof(Block)) {
+        keep = sizeof(Block);
+    }
+    if (BLOCK_SIZE(last) <= keep) {
+        return 0;
+    }
+    size_t trim = (BLOCK_SIZE(last) - keep) & ~(page_size() - 1);
+    if (trim == 0) {
+        return 0;
+    }
+
+    LOCK(&heapLock);
+    if (sbrk(0) != (void*)(fence + 1)) {
+        UNLOCK(&heapLock);
+        return 0; // someone else owns the memory above the fence
+    }
+    free_unlink(arena, last);
+    last->size -= trim;
+    fence = BLOCK_NEXT(last);
+    fence->size = 0;
+    fence->arena = arena;
+    arena->fence = fence;
+    block_release(arena, last);
+    sbrk(-(intptr_t)trim);
+    globalStats.sbrkCalls++;
+    arena->heapBytes -= trim;
+    UNLOCK(&heapLock);
+    return trim;
+}
+
+// release every span idle for at least idleMs (all of them for 0), returns
+// the bytes given back, the arena lock must be held
+static size_t arena_scavenge(Arena* arena, unsigned long long now, unsigned long long idleMs, size_t pad) {
+    arena_drain_remote(arena);
+    // trim first so pages about to leave with the break are not advised too
+    size_t trimmed = arena_trim_top(arena, pad);
+    size_t released = 0;
+    for (size_t index = bin_index(SCAVENGE_MIN_SPAN); index < NUM_BINS; ++index) {
+        for (Block* block = arena->bins[index]; block != NULL; block = block->next) {
+            if (span_idle(block, now, idleMs)) {
+                released += span_release(block);
+            }
+        }
+    }
+    // a top chunk the break could not shrink is released like any other span,
+    // one that was just trimmed keeps its pad
+    if (trimmed == 0 && arena->top != NULL && span_idle(arena->top, now, idleMs)) {
+        released += span_release(arena->top);
+    }
+    arena->lastScavenge = now;
+
+    __atomic_add_fetch(&scavengeStats.releasedBytes, released, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scavengeStats.trimmedBytes, trimmed, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&scavengeStats.passes, 1, __ATOMIC_RELAXED);
+    return released + trimmed;
+}
+
+// cheap check from the free path, runs a decay pass once per interval
+static void arena_maybe_scavenge(Arena* arena) {
+    if (++arena->freesSinceCheck < SCAVENGE_CHECK_EVERY || scavengeIntervalMs == 0) {
+        return;
+    }
+    arena->freesSinceCheck = 0;
+    unsigned long long now = now_ms();
+    if (now - arena->lastScavenge >= scavengeIntervalMs) {
+        arena_scavenge(arena, now, scavengeIntervalMs, TOP_PAD);
+    }
+}
+
+size_t kumalloc_trim(size_t pad) {
+    size_t returned = 0;
+    arena_get(); // make sure the arena locks exist
+    for (int i = 0; i < KU_NUM_ARENAS; ++i) {
+        Arena* arena = &arenas[i];
+        LOCK(&arena->lock);
+        returned += arena_scavenge(arena, now_ms(), 0, pad);
+        UNLOCK(&arena->lock);
+    }
+    return returned;
+}
+
+void kumalloc_scavenge_stats(KuScavengeStats* stats) {
+    __atomic_load(&scavengeStats.releasedBytes, &stats->releasedBytes, __ATOMIC_RELAXED);
+    __atomic_load(&scavengeStats.trimmedBytes, &stats->trimmedBytes, __ATOMIC_RELAXED);
+    __atomic_load(&scavengeStats.passes, &stats->passes, __ATOMIC_RELAXED);
+}
+
+#ifdef KU_THREAD_SAFE
+static void* scavenger_main(void* unused) {
+    (void)unused;
+    for (;;) {
+        unsigned int interval = scavengeIntervalMs;
+        if (interval == 0) {
+            interval = SCAVENGE_INTERVAL_MS; // paused, poll for a new setting
+        }
+        struct timespec delay = {interval / 1000, (interval % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+        if (scavengeIntervalMs == 0) {
+            continue;
+        }
+        for (int i = 0; i < KU_NUM_ARENAS; ++i) {
+            Arena* arena = &arenas[i];
+            LOCK(&arena->lock);
+            arena_scavenge(arena, now_ms(), scavengeIntervalMs, TOP_PAD);
+            UNLOCK(&arena->lock);
+        }
+    }
+    return NULL;
+}
+
+static void scavenger_start(void) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, scavenger_main, NULL);
+    pthread_attr_destroy(&attr);
+}
+#endif
+
+void kumalloc_set_scavenge_interval(unsigned int ms) {
+    scavengeIntervalMs = ms;
+#ifdef KU_THREAD_SAFE
+    static pthread_once_t scavengerOnce = PTHREAD_ONCE_INIT;
+    arena_get(); // arenas must be initialised before the thread locks them
+    if (ms != 0) {
+        pthread_once(&scavengerOnce, scavenger_start);
+    }
+#endif
+}
+
+/*
+ * Nursery, built with -DKU_NURSERY. Requests of up to NURSERY_MAX bytes are
+ * cut from the calling thread's current chunk by bumping a pointer, behind
+ * an ordinary header so size lookups work unchanged. With KU_SMALL_OBJECTS
+ * as well, requests of up to SMALL_OBJECT_LIMIT stay with the headerless
+ * slabs, which pack them tighter and reuse them one by one.
+ * Nothing inside a chunk is ever reused on its own: a chunk counts its live
+ * objects and goes back to the free list as a whole once the count reaches
+ * zero. While a chunk is a thread's current one its owner counts its
+ * allocations and frees privately and only other threads count down in
+ * live, so the owner needs no atomics; letting go adds the private balance
+ * in, and whoever brings the sum to zero recycles the chunk.
+ * When everything the owner handed out has come back it rewinds the chunk
+ * instead, so a cycle that frees all it allocated keeps reusing the same
+ * few cache lines. All chunks come from one reservation, which turns the
+ * ownership test in kufree into a range check. A single long-lived object
+ * pins its whole chunk; kuheap_walk shows which chunks are held that way.
+ */
+#ifdef KU_NURSERY
+#define NURSERY_MAX 256
+#ifdef KU_SMALL_OBJECTS
+#define NURSERY_MIN SMALL_OBJECT_LIMIT  // smaller requests are served headerless
+#else
+#define NURSERY_MIN 0
+#endif
+#define NURSERY_CHUNK ((size_t)64 * 1024)
+#define NURSERY_RESERVE ((size_t)1024 * 1024 * 1024)  // address space only
+#define NURSERY_FIRST 64  // objects start on their own cache line
+
+typedef struct NurseryChunk {
+    long live;                  // other threads' frees count down, the owner adds its balance when it lets go
+    unsigned int allocated;     // handed out since the last rewind, owner only
+    unsigned int freed;         // of those, freed by the owner while it still owns the chunk
+    unsigned char owned;
+    char* bump;                 // owner only
+    struct NurseryChunk* next;  // on nurseryFree
+} NurseryChunk;
+
+_Static_assert(sizeof(NurseryChunk) <= NURSERY_FIRST, "nursery chunk header too big");
+
+// reservation and its committed part, nurseryBytes stays 0 until it exists
+static char* nurseryBase;
+static size_t nurseryBytes;
+static char* nurseryCommitted;
+static NurseryChunk* nurseryFree;
+static __thread NurseryChunk* nurseryChunk;
+
+#define NURSERY_OWNS(ptr) ((uintptr_t)(ptr) - (uintptr_t)nurseryBase < nurseryBytes)
+#define NURSERY_CHUNK_OF(ptr) ((NurseryChunk*)((uintptr_t)(ptr) & ~(uintptr_t)(NURSERY_CHUNK - 1)))
+
+static void nursery_rewind(NurseryChunk* chunk) {
+    chunk->bump = (char*)chunk + NURSERY_FIRST;
+    __atomic_store_n(&chunk->allocated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&chunk->freed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&chunk->live, 0, __ATOMIC_RELAXED);
+}
+
+// a free chunk, or a new one from the reservation, NULL once it is used up
+static NurseryChunk* nursery_get(void) {
+    LOCK(&nurseryLock);
+    NurseryChunk* chunk = nurseryFree;
+    if (chunk != NULL) {
+        nurseryFree = chunk->next;
+    } else {
+        if (nurseryBase == NULL) {
+            char* mapped = mmap(NULL, NURSERY_RESERVE + NURSERY_CHUNK, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (mapped == MAP_FAILED) {
+                UNLOCK(&nurseryLock);
+                return NULL;
+            }
+            nurseryBase = (char*)(((uintptr_t)mapped + NURSERY_CHUNK - 1) & ~(uintptr_t)(NURSERY_CHUNK - 1));
+            nurseryCommitted = nurseryBase;
+            __atomic_store_n(&nurseryBytes, NURSERY_RESERVE, __ATOMIC_RELEASE);
+        }
+        if (nurseryCommitted == nurseryBase + NURSERY_RESERVE
+            || mprotect(nurseryCommitted, NURSERY_CHUNK, PROT_READ | PROT_WRITE) != 0) {
+            UNLOCK(&nurseryLock);
+            return NULL;
+        }
+        chunk = (NurseryChunk*)nurseryCommitted;
+        nurseryCommitted += NURSERY_CHUNK;
+        STAT_ADD(globalStats.nurseryBytes, NURSERY_CHUNK);
+    }
+    UNLOCK(&nurseryLock);
+    nursery_rewind(chunk);
+    __atomic_store_n(&chunk->owned, 1, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+static void nursery_put(NurseryChunk* chunk) {
+    LOCK(&nurseryLock);
+    chunk->next = nurseryFree;
+    nurseryFree = chunk;
+    UNLOCK(&nurseryLock);
+}
+
+// stop allocating from the current chunk, recycling it if nothing is live
+static void nursery_release(void) {
+    NurseryChunk* chunk = nurseryChunk;
+    if (chunk == NULL) {
+        return;
+    }
+    nurseryChunk = NULL;
+    __atomic_store_n(&chunk->owned, 0, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&chunk->live, chunk->allocated - chunk->freed, __ATOMIC_ACQ_REL) == 0) {
+        nursery_put(chunk);
+    }
+}
+
+static void* nursery_alloc(size_t size) {
+    NurseryChunk* chunk = nurseryChunk;
+    size_t need = sizeof(Block) + size;
+    if (chunk == NULL || (size_t)((char*)chunk + NURSERY_CHUNK - chunk->bump) < need) {
+        if (chunk != NULL && __atomic_load_n(&chunk->live, __ATOMIC_ACQUIRE) + chunk->allocated - chunk->freed == 0) {
+            nursery_rewind(chunk);
+        } else {
+            nursery_release();
+            arena_get(); // a thread that only uses the nursery still needs the exit flush
+            if ((chunk = nursery_get()) == NULL) {
+                return NULL;
+            }
+            nurseryChunk = chunk;
+        }
+    }
+    Block* block = (Block*)chunk->bump;
+    chunk->bump += need;
+    __atomic_store_n(&chunk->allocated, chunk->allocated + 1, __ATOMIC_RELAXED);
+    block->size = size;
+    block->arena = NULL;
+    return block + 1;
+}
+
+static void nursery_free(void* ptr) {
+    NurseryChunk* chunk = NURSERY_CHUNK_OF(ptr);
+    if (chunk == nurseryChunk) {
+        // only the owner can tell that its chunk emptied out
+        __atomic_store_n(&chunk->freed, chunk->freed + 1, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&chunk->live, __ATOMIC_ACQUIRE) + chunk->allocated - chunk->freed == 0) {
+            nursery_rewind(chunk);
+        }
+    } else if (__atomic_sub_fetch(&chunk->live, 1, __ATOMIC_ACQ_REL) == 0) {
+        nursery_put(chunk);
+    }
+}
+
+// report every committed chunk with its live objects
+static int nursery_walk(KuHeapWalker walker, void* arg) {
+    KuHeapBlock info = {.state = KU_HEAP_NURSERY, .size = NURSERY_CHUNK, .arena = -1};
+    int stop = 0;
+    LOCK(&nurseryLock);
+    for (char* memory = nurseryBase; memory < nurseryCommitted && !stop; memory += NURSERY_CHUNK) {
+        NurseryChunk* chunk = (NurseryChunk*)memory;
+        long live = __atomic_load_n(&chunk->live, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&chunk->owned, __ATOMIC_RELAXED)) {
+            live += __atomic_load_n(&chunk->allocated, __ATOMIC_RELAXED)
+                - __atomic_load_n(&chunk->freed, __ATOMIC_RELAXED);
+        }
+        info.address = chunk;
+        info.objects = live > 0 ? (unsigned int)live : 0;
+        stop = walker(&info, arg);
+    }
+    UNLOCK(&nurseryLock);
+    return stop;
+}
+#endif
+
+/*
+ * Per-thread cache in front of the arenas for the exact small size classes.
+ * Cached blocks still count as allocated for their arena (header and owner
+ * are untouched), the cache links them through the first payload word. A miss
+ * refills TCACHE_BATCH blocks under one lock and a cache that grows past
+ * TCACHE_HIGH_WATER hands TCACHE_BATCH blocks back, so the common case
+ * kumalloc/kufree is a thread-local push or pop with no lock and no atomics.
+ */
+#define TCACHE_BATCH 16
+#define TCACHE_HIGH_WATER 64
+
+typedef struct ThreadCache {
+    Block* lists[NUM_SMALL_BINS];
+    unsigned int counts[NUM_SMALL_BINS];
+    // calls served through this cache, kumalloc_stats reads them unlocked
+    size_t allocs[NUM_SMALL_BINS];
+    size_t frees[NUM_SMALL_BINS];
+#ifdef KU_SMALL_OBJECTS
+    void* objects[SMALL_OBJECT_CLASSES];  // headerless objects, linked through their first word
+    unsigned int objectCounts[SMALL_OBJECT_CLASSES];
+#endif
+    struct ThreadCache* next;  // registry of live caches
+    struct ThreadCache* prev;
+    unsigned char dead;        // flushed at thread exit, nothing may stay in it any more
+#ifdef KU_PER_CPU_CACHE
+    Lock lock;  // per-CPU caches only, a thread may be migrated while using one
+#endif
+} ThreadCache;
+
+static __thread ThreadCache threadCache;
+
+/*
+ * Per-CPU cache mode, built with -DKU_PER_CPU_CACHE on top of KU_THREAD_SAFE.
+ * The small size classes are cached per CPU instead of per thread, so the
+ * blocks parked in caches are bounded by the number of cores however many
+ * mostly idle threads a program keeps. rseq is only used to read the CPU
+ * number, one load from the area glibc registers for every thread, with
+ * sched_getcpu where the kernel has no rseq. There are no restartable
+ * sequences: the thread may move to another CPU at any point, so every
+ * cached allocation and free takes the cache's mutex in cache_acquire. It
+ * is rarely contended, since mostly threads on that CPU take it.
+ */
+#ifdef KU_PER_CPU_CACHE
+#include <fcntl.h>
+#include <sched.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define KU_HAVE_RSEQ
+#endif
+#ifndef KU_MAX_CPUS
+#define KU_MAX_CPUS 256  // CPUs with higher numbers share caches
+#endif
+
+static ThreadCache cpuCaches[KU_MAX_CPUS];
+static unsigned int cpuCount = 0;
+
+// number of possible CPUs, parsed by hand since this runs inside the first
+// kumalloc call where stdio or sysconf could allocate
+static unsigned int cpu_possible(void) {
+    char text[256];
+    int fd = open("/sys/devices/system/cpu/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return KU_MAX_CPUS;
+    }
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (len <= 0) {
+        return KU_MAX_CPUS;
+    }
+    // a list of ranges like "0-3,8-11", the last number is the highest CPU
+    unsigned int highest = 0;
+    unsigned int number = 0;
+    for (ssize_t i = 0; i < len; ++i) {
+        if (text[i] >= '0' && text[i] <= '9') {
+            number = number * 10 + (text[i] - '0');
+        } else {
+            highest = number > highest ? number : highest;
+            number = 0;
+        }
+    }
+    highest = number > highest ? number : highest;
+    return highest + 1 < KU_MAX_CPUS ? highest + 1 : KU_MAX_CPUS;
+}
+
+static void cpu_caches_init(void) {
+    cpuCount = cpu_possible();
+    for (unsigned int i = 0; i < cpuCount; ++i) {
+        LOCK_INIT(&cpuCaches[i].lock);
+    }
+}
+
+static void cpu_caches_lock_all(void) {
+    for (unsigned int i = 0; i < cpuCount; ++i) {
+        LOCK(&cpuCaches[i].lock);
+    }
+}
+
+static void cpu_caches_unlock_all(void) {
+    for (unsigned int i = cpuCount; i-- > 0;) {
+        UNLOCK(&cpuCaches[i].lock);
+    }
+}
+
+static unsigned int cpu_current(void) {
+#ifdef KU_HAVE_RSEQ
+    if (__rseq_size > 0) {
+        struct rseq* area = (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+        int cpu = (int)__atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED);
+        if (cpu >= 0) {
+            return (unsigned int)cpu % cpuCount;
+        }
+    }
+#endif
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : (unsigned int)cpu % cpuCount;
+}
+
+// cache of the CPU the caller runs on, its mutex held until cache_release
+static ThreadCache* cache_acquire(void) {
+    arena_get(); // the caches are set up with the arenas
+    ThreadCache* cache = &cpuCaches[cpu_current()];
+    LOCK(&cache->lock);
+    return cache;
+}
+
+#define cache_release(cache) UNLOCK(&(cache)->lock)
+#else
+#define cache_acquire() (&threadCache)
+#define cache_release(cache) ((void)(cache))
+#endif
+
+/*
+ * The exit flush runs once, but TLS destructors that run after it may still
+ * allocate and free. The thread's own cache is marked dead then: frees pass
+ * straight through to the arenas and refills hand out a single block, so
+ * nothing is parked where no flush will find it. Per-CPU caches outlive
+ * their threads and are never dead.
+ */
+#ifdef KU_THREAD_SAFE
+#define THREAD_EXITED() (threadCache.dead)
+#else
+#define THREAD_EXITED() 0
+#endif
+#define CACHE_DEAD(cache) ((cache) == &threadCache && THREAD_EXITED())
+
+// every live thread cache, and the counters of caches whose thread is gone
+#ifdef KU_THREAD_SAFE
+static ThreadCache* cacheList = NULL;
+#endif
+static ThreadCache retiredCaches;
+
+#define TCACHE_LINK(block) (*(Block**)((block) + 1))
+
+static void tcache_push(ThreadCache* cache, size_t index, Block* block) {
+    TCACHE_LINK(block) = cache->lists[index];
+    cache->lists[index] = block;
+    cache->counts[index]++;
+}
+
+static Block* tcache_pop(ThreadCache* cache, size_t index) {
+    Block* block = cache->lists[index];
+    cache->lists[index] = TCACHE_LINK(block);
+    cache->counts[index]--;
+    return block;
+}
+
+// fill an empty list with up to TCACHE_BATCH blocks and return one of them
+static Block* tcache_refill(ThreadCache* cache, size_t index, size_t size) {
+    Arena* arena = arena_get();
+    int batch = CACHE_DEAD(cache) ? 1 : TCACHE_BATCH;
+    Block* block;
+    LOCK(&arena->lock);
+    block = arena_malloc(arena, size, NULL);
+    for (int i = 1; block != NULL && i < batch; ++i) {
+        Block* extra = arena_malloc(arena, size, NULL);
+        if (extra == NULL) {
+            break;
+        }
+        if (BLOCK_SIZE(extra) != size) {
+            // the leftover was too small to split off, not an exact fit
+            arena_free(arena, extra);
+            break;
+        }
+        tcache_push(cache, index, extra);
+    }
+    UNLOCK(&arena->lock);
+    return block;
+}
+
+// return count blocks from the list to their arenas, one lock per owner run,
+// blocks of other arenas go onto their remote lists
+static void tcache_drain(ThreadCache* cache, size_t index, unsigned int count) {
+    Arena* locked = NULL;
+#ifdef KU_THREAD_SAFE
+    Block* chain = NULL;  // run of blocks for one remote owner, pushed with one CAS
+    Block* chainLast = NULL;
+#endif
+    while (count-- > 0 && cache->lists[index] != NULL) {
+        Block* block = tcache_pop(cache, index);
+#ifdef KU_THREAD_SAFE
+        if (block->arena != threadArena) {
+            if (chain != NULL && chain->arena != block->arena) {
+                remote_push(chain->arena, chain, chainLast);
+                chain = NULL;
+            }
+            REMOTE_LINK(block) = chain;
+            if (chain == NULL) {
+                chainLast = block;
+            }
+            chain = block;
+            continue;
+        }
+#endif
+        if (block->arena != locked) {
+            if (locked) {
+                UNLOCK(&locked->lock);
+            }
+            locked = block->arena;
+            LOCK(&locked->lock);
+        }
+        arena_free(locked, block);
+    }
+    if (locked) {
+        arena_maybe_scavenge(locked);
+        UNLOCK(&locked->lock);
+    }
+#ifdef KU_THREAD_SAFE
+    if (chain != NULL) {
+        remote_push(chain->arena, chain, chainLast);
+    }
+#endif
+}
+
+// calls made after the exit flush are counted straight into the retired
+// totals, the cache is off the list kumalloc_stats walks by then
+static void tcache_retire_late(size_t index) {
+    LOCK(&cacheListLock);
+    retiredCaches.allocs[index] += threadCache.allocs[index];
+    retiredCaches.frees[index] += threadCache.frees[index];
+    threadCache.allocs[index] = 0;
+    threadCache.frees[index] = 0;
+    UNLOCK(&cacheListLock);
+}
+
+#ifdef KU_THREAD_SAFE
+// thread exit hook, hands every cached block back
+static void tcache_flush(void* unused) {
+    (void)unused;
+    threadCache.dead = 1;
+#ifdef KU_NURSERY
+    nursery_release();
+#endif
+    for (size_t i = 0; i < NUM_SMALL_BINS; ++i) {
+        tcache_drain(&threadCache, i, threadCache.counts[i]);
+    }
+#ifdef KU_SMALL_OBJECTS
+    for (size_t i = 0; i < SMALL_OBJECT_CLASSES; ++i) {
+        small_drain(&threadCache, i, threadCache.objectCounts[i]);
+    }
+#endif
+
+    LOCK(&cacheListLock);
+    for (size_t i = 0; i < NUM_SMALL_BINS; ++i) {
+        retiredCaches.allocs[i] += threadCache.allocs[i];
+        retiredCaches.frees[i] += threadCache.frees[i];
+        threadCache.allocs[i] = 0;
+        threadCache.frees[i] = 0;
+    }
+    if (threadCache.prev) {
+        threadCache.prev->next = threadCache.next;
+    } else {
+        cacheList = threadCache.next;
+    }
+    if (threadCache.next) {
+        threadCache.next->prev = threadCache.prev;
+    }
+    UNLOCK(&cacheListLock);
+}
+
+static void tcache_register(void) {
+    LOCK(&cacheListLock);
+    threadCache.prev = NULL;
+    threadCache.next = cacheList;
+    if (cacheList) {
+        cacheList->prev = &threadCache;
+    }
+    cacheList = &threadCache;
+    UNLOCK(&cacheListLock);
+}
+#endif
+
+// put a small block into the caller's cache, handing a batch back to the
+// arenas once the cache grows past the high water mark
+static void tcache_free(Block* block, size_t index) {
+    arena_get(); // threads that only free still need the exit flush
+    ThreadCache* cache = cache_acquire();
+    tcache_push(cache, index, block);
+    cache->frees[index]++;
+    if (cache->counts[index] > TCACHE_HIGH_WATER || CACHE_DEAD(cache)) {
+        tcache_drain(cache, index, TCACHE_BATCH);
+    }
+    if (CACHE_DEAD(cache)) {
+        tcache_retire_late(index);
+    }
+    cache_release(cache);
+}
+
+void* kumalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    // align size to the nearest multiple of sizeof(Block)
+    if (size > SIZE_MAX - sizeof(Block)) {
+        return NULL;
+    }
+    size = (size + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+
+#ifdef KU_NURSERY
+    // a chunk taken after the exit flush would never be let go again
+    if (size > NURSERY_MIN && size <= NURSERY_MAX && !THREAD_EXITED()) {
+        void* ptr = nursery_alloc(size);
+        if (ptr != NULL) {
+            return ptr;
+        }
+        // the reservation is used up, serve it the usual way
+    }
+#endif
+#ifdef KU_SMALL_OBJECTS
+    if (size <= SMALL_OBJECT_LIMIT) {
+        return small_alloc(bin_index(size));
+    }
+#endif
+
+    if (size < SMALL_BIN_LIMIT) {
+        size_t index = bin_index(size);
+        ThreadCache* cache = cache_acquire();
+        Block* block = cache->lists[index] != NULL
+            ? tcache_pop(cache, index)
+            : tcache_refill(cache, index, size);
+        cache->allocs[index]++;
+        if (CACHE_DEAD(cache)) {
+            tcache_retire_late(index);
+        }
+        cache_release(cache);
+        return block ? (void*)(block + 1) : NULL;
+    }
+
+    if (size >= mmapThreshold) {
+        Block* block = mmap_alloc(size);
+        return block ? (void*)(block + 1) : NULL;
+    }
+
+    Arena* arena = arena_get();
+    LOCK(&arena->lock);
+    Block* block = arena_malloc(arena, size, NULL);
+    arena->allocs[bin_index(size)]++;
+    UNLOCK(&arena->lock);
+    return block ? (void*)(block + 1) : NULL;
+}
+
+void *kucalloc(size_t nmemb, size_t size) {
+    size_t totalSize;
+    if (__builtin_mul_overflow(nmemb, size, &totalSize) || totalSize == 0 || totalSize > SIZE_MAX - sizeof(Block)) {
+        return NULL;
+    }
+    size_t blockSize = (totalSize + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+
+    // mappings are fresh zero pages and small blocks are cheap to clear, only
+    // the arena path can hand out memory that is already known to be zero
+    if (blockSize < SMALL_BIN_LIMIT) {
+        void* ptr = kumalloc(totalSize);
+        if (ptr != NULL) {
+            memset(ptr, 0, totalSize);
+        }
+        return ptr;
+    }
+    if (blockSize >= mmapThreshold) {
+        void* ptr = kumalloc(totalSize);
+        if (ptr != NULL && !(((Block*)ptr - 1)->size & BLOCK_MMAPPED)) {
+            memset(ptr, 0, totalSize);
+        }
+        return ptr;
+    }
+
+    int zero;
+    Arena* arena = arena_get();
+    LOCK(&arena->lock);
+    Block* block = arena_malloc(arena, blockSize, &zero);
+    arena->allocs[bin_index(blockSize)]++;
+    UNLOCK(&arena->lock);
+    if (block == NULL) {
+        return NULL;
+    }
+    void* ptr = block + 1;
+    if (zero) {
+        // only the bookkeeping words at either end can be non-zero
+        memset(ptr, 0, ZERO_DIRTY_BYTES);
+        if (BLOCK_SIZE(block) - sizeof(size_t) < totalSize) {
+            memset((char*)ptr + BLOCK_SIZE(block) - sizeof(size_t), 0, sizeof(size_t));
+        }
+    } else {
+        memset(ptr, 0, totalSize);
+    }
+    return ptr;
+}
+void kufree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+#ifdef KU_NURSERY
+    if (NURSERY_OWNS(ptr)) {
+        nursery_free(ptr);
+        return;
+    }
+#endif
+#ifdef KU_SMALL_OBJECTS
+    size_t class = small_class(ptr);
+    if (class != 0) {
+        small_free(ptr, class - 1);
+        return;
+    }
+#endif
+
+    Block *blockToFree = (Block *)((char *)ptr - sizeof(Block));
+
+    if (blockToFree->size & BLOCK_MMAPPED) {
+        mmap_free(blockToFree);
+        return;
+    }
+
+    if (BLOCK_SIZE(blockToFree) < SMALL_BIN_LIMIT) {
+        tcache_free(blockToFree, bin_index(BLOCK_SIZE(blockToFree)));
+        return;
+    }
+
+    Arena *arena = blockToFree->arena;
+#ifdef KU_THREAD_SAFE
+    if (arena != arena_get()) {
+        STAT_ADD(globalStats.frees[bin_index(BLOCK_SIZE(blockToFree))], 1);
+        remote_push(arena, blockToFree, blockToFree);
+        return;
+    }
+#endif
+    LOCK(&arena->lock);
+    arena->frees[bin_index(BLOCK_SIZE(blockToFree))]++;
+    arena_free(arena, blockToFree);
+    arena_maybe_scavenge(arena);
+    UNLOCK(&arena->lock);
+}
+
+/*
+ * Bulk allocation and release. kumalloc_batch carves all n blocks out of one
+ * free span per BATCH_SPAN_MAX bytes under a single lock instead of running
+ * a search per object, and kufree_batch sorts its pointers by address so a
+ * run of physical neighbours is merged into one block and given back with a
+ * single arena_free. Only the caller's own arena is locked; blocks of other
+ * arenas go onto their remote lists, one push per run of the same owner.
+ * Headerless small objects and mapped blocks still go one by one, they have
+ * no free list work to share.
+ */
+#define BATCH_SPAN_MAX (64 * 1024)
+
+size_t kumalloc_batch(size_t n, size_t size, void** out) {
+    if (size == 0 || size > SIZE_MAX - sizeof(Block)) {
+        return 0;
+    }
+    size = (size + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+    size_t done = 0;
+
+#ifdef KU_SMALL_OBJECTS
+    if (size <= SMALL_OBJECT_LIMIT) {
+        for (; done < n; ++done) {
+            if ((out[done] = small_alloc(bin_index(size))) == NULL) {
+                break;
+            }
+        }
+        return done;
+    }
+#endif
+    if (size >= mmapThreshold) {
+        for (; done < n; ++done) {
+            Block* block = mmap_alloc(size);
+            if (block == NULL) {
+                break;
+            }
+            out[done] = block + 1;
+        }
+        return done;
+    }
+
+    size_t stride = size + sizeof(Block);
+    size_t perSpan = BATCH_SPAN_MAX / stride ? BATCH_SPAN_MAX / stride : 1;
+    Arena* arena = arena_get();
+    LOCK(&arena->lock);
+    while (done < n) {
+        size_t count = n - done < perSpan ? n - done : perSpan;
+        Block* block = arena_malloc(arena, count * stride - sizeof(Block), NULL);
+        if (block == NULL) {
+            break;
+        }
+        // cut it into count blocks, the last one keeps whatever the span had over
+        char* end = (char*)BLOCK_NEXT(block);
+        for (size_t i = 1; i < count; ++i) {
+            block->size = size | (block->size & BLOCK_PREV_FREE);
+            out[done++] = block + 1;
+            block = BLOCK_NEXT(block);
+            block->size = 0;
+            block->arena = arena;
+        }
+        block->size = (end - (char*)(block + 1)) | (block->size & BLOCK_PREV_FREE);
+        out[done++] = block + 1;
+        arena->allocs[bin_index(size)] += count;
+        arena->splits += count - 1;
+    }
+    UNLOCK(&arena->lock);
+    return done;
+}
+
+#define SORT_INSERTION 16
+
+// qsort would call a comparator per step and may malloc its scratch space,
+// which under KU_SYSTEM_ALLOCATOR is us; recursing into the smaller half
+// keeps the stack depth logarithmic
+static void sort_addresses(void** ptrs, size_t n) {
+    while (n > SORT_INSERTION) {
+        // median of three as the pivot, so sorted input stays n log n
+        void** mid = ptrs + n / 2;
+        void** last = ptrs + n - 1;
+        if ((uintptr_t)*mid < (uintptr_t)*ptrs) {
+            void* swap = *mid;
+            *mid = *ptrs;
+            *ptrs = swap;
+        }
+        if ((uintptr_t)*last < (uintptr_t)*mid) {
+            void* swap = *last;
+            *last = *mid;
+            *mid = swap;
+            if ((uintptr_t)*mid < (uintptr_t)*ptrs) {
+                swap = *mid;
+                *mid = *ptrs;
+                *ptrs = swap;
+            }
+        }
+        uintptr_t pivot = (uintptr_t)*mid;
+        size_t left = 0;
+        size_t right = n - 1;
+        for (;;) {
+            while ((uintptr_t)ptrs[left] < pivot) {
+                ++left;
+            }
+            while ((uintptr_t)ptrs[right] > pivot) {
+                --right;
+            }
+            if (left >= right) {
+                break;
+            }
+            void* swap = ptrs[left];
+            ptrs[left++] = ptrs[right];
+            ptrs[right--] = swap;
+        }
+        if (right + 1 < n - right - 1) {
+            sort_addresses(ptrs, right + 1);
+            ptrs += right + 1;
+            n -= right + 1;
+        } else {
+            sort_addresses(ptrs + right + 1, n - right - 1);
+            n = right + 1;
+        }
+    }
+    for (size_t i = 1; i < n; ++i) {
+        void* ptr = ptrs[i];
+        size_t j = i;
+        for (; j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)ptr; --j) {
+            ptrs[j] = ptrs[j - 1];
+        }
+        ptrs[j] = ptr;
+    }
+}
+
+void kufree_batch(size_t n, void** ptrs) {
+    sort_addresses(ptrs, n);
+    Arena* locked = NULL;
+#ifdef KU_THREAD_SAFE
+    Arena* own = arena_get();
+    Block* chain = NULL;  // run of blocks for one remote owner, pushed with one CAS
+    Block* chainLast = NULL;
+#endif
+    size_t i = 0;
+    while (i < n) {
+        void* ptr = ptrs[i++];
+        if (ptr == NULL) {
+            continue;
+        }
+#ifdef KU_NURSERY
+        if (NURSERY_OWNS(ptr)) {
+            nursery_free(ptr);
+            continue;
+        }
+#endif
+#ifdef KU_SMALL_OBJECTS
+        size_t class = small_class(ptr);
+        if (class != 0) {
+            // the object caches are locked before the arenas, never after
+            if (locked) {
+                UNLOCK(&locked->lock);
+                locked = NULL;
+            }
+            small_free(ptr, class - 1);
+            continue;
+        }
+#endif
+        Block* block = (Block*)ptr - 1;
+        if (block->size & BLOCK_MMAPPED) {
+            mmap_free(block);
+            continue;
+        }
+#ifdef KU_THREAD_SAFE
+        // like kufree, other arenas get their blocks through the remote lists
+        if (block->arena != own) {
+            STAT_ADD(globalStats.frees[bin_index(BLOCK_SIZE(block))], 1);
+            if (chain != NULL && chain->arena != block->arena) {
+                remote_push(chain->arena, chain, chainLast);
+                chain = NULL;
+            }
+            REMOTE_LINK(block) = chain;
+            if (chain == NULL) {
+                chainLast = block;
+            }
+            chain = block;
+            continue;
+        }
+#endif
+        if (block->arena != locked) {
+            if (locked) {
+                arena_maybe_scavenge(locked);
+                UNLOCK(&locked->lock);
+            }
+            locked = block->arena;
+            LOCK(&locked->lock);
+        }
+        locked->frees[bin_index(BLOCK_SIZE(block))]++;
+        // swallow the following pointers while they are the next blocks in memory
+        while (i < n && ptrs[i] == (void*)(BLOCK_NEXT(block) + 1)) {
+            Block* next = BLOCK_NEXT(block);
+            locked->frees[bin_index(BLOCK_SIZE(next))]++;
+            locked->coalesces++;
+            block->size += sizeof(Block) + BLOCK_SIZE(next);
+            ++i;
+        }
+        arena_free(locked, block);
+    }
+    if (locked) {
+        arena_maybe_scavenge(locked);
+        UNLOCK(&locked->lock);
+    }
+#ifdef KU_THREAD_SAFE
+    if (chain != NULL) {
+        remote_push(chain->arena, chain, chainLast);
+    }
+#endif
+}
+
+void kufree_sized(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    size = (size + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+#ifdef KU_NURSERY
+    if (NURSERY_OWNS(ptr)) {
+        nursery_free(ptr);
+        return;
+    }
+#endif
+#ifdef KU_SMALL_OBJECTS
+    // kumalloc only ever hands out headerless objects at these sizes
+    if (size != 0 && size <= SMALL_OBJECT_LIMIT) {
+        small_free(ptr, bin_index(size));
+        return;
+    }
+#endif
+    // the block may be a little bigger than its class, the cache does not mind
+    if (size != 0 && size < SMALL_BIN_LIMIT) {
+        tcache_free((Block*)ptr - 1, bin_index(size));
+        return;
+    }
+    // anything bigger needs the header for its arena or mapping anyway
+    kufree(ptr);
+}
+
+
+/*
+ * Aligned allocation. The aligned payload is carved out of a free block: the
+ * part in front of it goes back to the bins as a free block of its own (so
+ * the gap is either zero or at least MIN_FREE_BLOCK) and the tail is split
+ * off as usual, which leaves no padding behind. Up to ALIGN_SCAN_LIMIT free
+ * blocks are checked for one that already holds an aligned spot; failing
+ * that a block big enough for any placement is taken and cut on both sides.
+ */
+#define ALIGN_SCAN_LIMIT 32
+#define MIN_FREE_BLOCK (2 * sizeof(Block))  // header, bin back-link and boundary tag
+
+// aligned payload address inside block with room for size bytes, or NULL
+static char* aligned_spot(Block* block, size_t align, size_t size) {
+    char* start = (char*)(block + 1);
+    char* spot = (char*)(((uintptr_t)start + align - 1) & ~(uintptr_t)(align - 1));
+    if (spot != start && spot - start < (ptrdiff_t)MIN_FREE_BLOCK) {
+        spot += align;
+    }
+    char* end = (char*)BLOCK_NEXT(block);
+    return spot <= end && (size_t)(end - spot) >= size ? spot : NULL;
+}
+
+// trim an in-use block to size bytes starting at spot, freeing both ends,
+// the arena lock must be held
+static Block* block_carve(Arena* arena, Block* block, char* spot, size_t size) {
+    block->size &= ~BLOCK_ZERO;
+    if (spot != (char*)(block + 1)) {
+        Block* aligned = (Block*)spot - 1;
+        aligned->size = (char*)BLOCK_NEXT(block) - spot;
+        aligned->arena = arena;
+        block->size = (spot - (char*)(block + 1) - sizeof(Block)) | (block->size & BLOCK_PREV_FREE);
+        arena->splits++;
+        arena_free(arena, block);
+        block = aligned;
+    }
+    block_split(arena, block, size);
+    return block;
+}
+
+// size bytes aligned to align (a power of two above sizeof(Block)), the
+// arena lock must be held
+static Block* arena_memalign(Arena* arena, size_t align, size_t size) {
+    size_t scanned = 0;
+    for (size_t index = bin_next_nonempty(arena, bin_index(size));
+         index < NUM_BINS && scanned < ALIGN_SCAN_LIMIT;
+         index = bin_next_nonempty(arena, index + 1)) {
+        for (Block* block = arena->bins[index]; block != NULL && scanned < ALIGN_SCAN_LIMIT; block = block->next) {
+            scanned++;
+            char* spot = aligned_spot(block, align, size);
+            if (spot == NULL) {
+                continue;
+            }
+            bin_remove(arena, block);
+            block->size &= ~BLOCK_FREE;
+            BLOCK_NEXT(block)->size &= ~BLOCK_PREV_FREE;
+            block->arena = arena;
+            if (scanned > arena->longestScan) {
+                arena->longestScan = scanned;
+            }
+            return block_carve(arena, block, spot, size);
+        }
+    }
+
+    // the worst placement needs align + sizeof(Block) bytes in front
+    Block* block = arena_malloc(arena, size + align + sizeof(Block), NULL);
+    if (block == NULL) {
+        return NULL;
+    }
+    return block_carve(arena, block, aligned_spot(block, align, size), size);
+}
+
+void *kumemalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || size == 0) {
+        return NULL;
+    }
+    if (alignment <= sizeof(Block)) {
+        return kumalloc(size);
+    }
+    if (alignment > SIZE_MAX / 4 || size > SIZE_MAX - 2 * sizeof(Block) - alignment) {
+        return NULL;
+    }
+    size = (size + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
+
+    if (size + alignment >= mmapThreshold) {
+        Block* block = mmap_alloc_aligned(alignment, size);
+        return block ? (void*)(block + 1) : NULL;
+    }
+
+    Arena* arena = arena_get();
+    LOCK(&arena->lock);
+    Block* block = arena_memalign(arena, alignment, size);
+    if (block != NULL) {
+        arena->allocs[bin_index(size)]++;
+    }
+    UNLOCK(&arena->lock);
+    return block ? (void*)(block + 1) : NULL;
+}
+
+int kuposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+    void* ptr = kumemalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *kualigned_alloc(size_t alignment, size_t size) {
+    return kumemalign(alignment, size);
+}
+
+/*
+ * Try to make block hold size bytes without moving it: absorb a free
+ * physical successor and, when the block then ends at the arena's fence,
+ * extend the arena the way an allocation would. The extension grows by
+ * growBytes like any other, and when it continues the region it becomes a
+ * top chunk right behind block, which is absorbed in turn, so growing a
+ * buffer at the top costs amortised O(1) heap calls. Returns 1 on success,
+ * the arena lock must be held.
+ */
+static int arena_grow_in_place(Arena* arena, Block* block, size_t size) {
+    for (int extended = 0;; extended = 1) {
+        Block* next = BLOCK_NEXT(block);
+        if ((next->size & BLOCK_FREE)
+            && (BLOCK_SIZE(block) + sizeof(Block) + BLOCK_SIZE(next) >= size || BLOCK_NEXT(next) == arena->fence)) {
+            free_unlink(arena, next);
+            block->size += sizeof(Block) + BLOCK_SIZE(next);
+            BLOCK_NEXT(block)->size &= ~BLOCK_PREV_FREE;
+        }
+        if (BLOCK_SIZE(block) >= size) {
+            return 1;
+        }
+        // a new region that does not continue this one stays as the arena's top
+        if (extended || BLOCK_NEXT(block) != arena->fence || !arena_extend(arena, size - BLOCK_SIZE(block))) {
+            return 0;
+        }
+    }
+}
+
+// resize a mapped block with mremap so the kernel moves page tables, not bytes
+static void* mmap_realloc(Block* block, size_t size) {
+    size_t pageMask = page_size() - 1;
+    char* base = MMAP_BASE(block);
+    size_t offset = (char*)block - base;
+    if (size > SIZE_MAX - sizeof(Block) - pageMask - offset) {
+        return NULL;
+    }
+    size_t oldLength = (char*)BLOCK_NEXT(block) - base;
+    size_t length = (offset + size + sizeof(Block) + pageMask) & ~pageMask;
+    if (length == oldLength) {
+        return block + 1;
+    }
+    LOCK(&mapLock);
+    char* moved = mremap(base, oldLength, length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        UNLOCK(&mapLock);
+        return NULL;
+    }
+    block = (Block*)(moved + offset);
+    block->size = (length - offset - sizeof(Block)) | BLOCK_MMAPPED;
+    mappedBlocks[block->slot] = block;
+    UNLOCK(&mapLock);
+    STAT_ADD(globalStats.mmapCalls, 1);
+    STAT_ADD(globalStats.mmapBytes, length - oldLength);
+    return block + 1;
+}
+
+void *kurealloc(void *ptr, size_t size)
+{
 
+   if (ptr == NULL) {
+        return kumalloc(size);
+    }
 
-void* kumalloc(size_t size) {
     if (size == 0) {
+        kufree(ptr);
         return NULL;
     }
 
-    // align size to the nearest multiple of sizeof(Block)
+    // keep block sizes aligned, the bins depend on it
+    if (size > SIZE_MAX - sizeof(Block)) {
+        return NULL;
+    }
     size = (size + sizeof(Block) - 1) & ~(sizeof(Block) - 1);
 
-    Block* bestBlock = NULL; // used for worst-fit
-    Block* bestPrev = NULL;  // previous block for worst-fit
+#ifdef KU_SMALL_OBJECTS
+    size_t class = small_class(ptr);
+    if (class != 0) {
+        size_t slotSize = class * sizeof(Block);
+        if (size <= slotSize) {
+            return ptr;
+        }
+        void* newPtr = kumalloc(size);
+        if (newPtr != NULL) {
+            memcpy(newPtr, ptr, slotSize);
+            kufree(ptr);
+        }
+        return newPtr;
+    }
+#endif
 
-    Block* current = head;
-    Block* prev = NULL;
+    Block* block = (Block*)((char*)ptr - sizeof(Block));
+    size_t oldSize = BLOCK_SIZE(block);
 
-    while (current != NULL) {
-        if (current->size >= size) {
-            // first-fit for small allocations
-            if (size < THRESHOLD_FOR_WORST_FIT) {
-                bestBlock = current;
-                bestPrev = prev;
-                break;
-            }
-            // worst-fit for larger allocations
-            if (bestBlock == NULL || current->size > bestBlock->size) {
-                bestBlock = current;
-                bestPrev = prev;
-            }
+#ifdef KU_NURSERY
+    // nursery blocks never change size, a bigger one is a move
+    if (NURSERY_OWNS(ptr)) {
+        if (oldSize >= size) {
+            return ptr;
+        }
+        void* newPtr = kumalloc(size);
+        if (newPtr != NULL) {
+            memcpy(newPtr, ptr, oldSize);
+            nursery_free(ptr);
         }
-        prev = current;
-        current = current->next;
+        return newPtr;
     }
+#endif
 
-    // if a suitable block is found
-    if (bestBlock) {
-        // remove block from free list
-        if (bestPrev) {
-            bestPrev->next = bestBlock->next;
-        } else {
-            head = bestBlock->next;
+    if (block->size & BLOCK_MMAPPED) {
+        if (size >= mmapThreshold) {
+            return mmap_realloc(block, size);
+        }
+        // fall through and move it into an arena
+    } else if (oldSize >= size) {
+        // if the new size is smaller split the block and free the tail
+        Arena* arena = block->arena;
+        LOCK(&arena->lock);
+        block_split(arena, block, size);
+        UNLOCK(&arena->lock);
+        return ptr;
+    } else {
+        // if the new size is larger try to extend the block where it is
+        Arena* arena = block->arena;
+        LOCK(&arena->lock);
+        int grown = arena_grow_in_place(arena, block, size);
+        if (grown) {
+            block_split(arena, block, size);
         }
-        // check if the block can be split
-        if (bestBlock->size > size + MIN_SPLIT_SIZE) {
-            Block* remainingBlock = (Block*)((char*)bestBlock + sizeof(Block) + size);
-            remainingBlock->size = bestBlock->size - size - sizeof(Block);
-            remainingBlock->next = head;
-            head = remainingBlock;
+        UNLOCK(&arena->lock);
+        if (grown) {
+            return ptr;
+        }
+    }
+
+    // allocate a new block
+    void* newPtr = kumalloc(size);
+    if (newPtr != NULL) {
+        // copy the contents from the old block to the new block
+        memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+        // free the old block
+        kufree(ptr);
+        return newPtr;
+    }
+    // a shrinking mapped block can stay where it is
+    return oldSize >= size ? ptr : NULL;
+}
+
+size_t kumalloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+#ifdef KU_SMALL_OBJECTS
+    size_t class = small_class(ptr);
+    if (class != 0) {
+        return class * sizeof(Block);
+    }
+#endif
+    return BLOCK_SIZE((Block*)ptr - 1);
+}
 
-            bestBlock->size = size;
+_Static_assert(NUM_BINS == KU_STATS_CLASSES, "alloc.h size classes out of sync");
+
+// largest free payload in arena, the arena lock must be held
+static size_t arena_largest_free(Arena* arena) {
+    size_t largest = arena->top ? BLOCK_SIZE(arena->top) : 0;
+    size_t index = bin_last_nonempty(arena);
+    if (index == NUM_BINS) {
+        return largest;
+    }
+    for (Block* block = arena->bins[index]; block != NULL; block = block->next) {
+        if (BLOCK_SIZE(block) > largest) {
+            largest = BLOCK_SIZE(block);
         }
+    }
+    return largest;
+}
 
-        return (void*)(bestBlock + 1);
+static void stats_add_cache(KuMallocStats* stats, ThreadCache* cache) {
+    for (size_t i = 0; i < NUM_SMALL_BINS; ++i) {
+        stats->allocs[i] += cache->allocs[i];
+        stats->frees[i] += cache->frees[i];
     }
+}
 
-    // allocate a new block if no suitable block is found in the free list
-    size_t allocSize = size < BATCH_SIZE ? BATCH_SIZE : size;
-    Block* newBlock = (Block*)sbrk(sizeof(Block) + allocSize);
-    if (newBlock == (void*)-1) {
-        return NULL; // sbrk failed
+void kumalloc_stats(KuMallocStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    arena_get(); // make sure the locks exist
+
+    for (int i = 0; i < KU_NUM_ARENAS; ++i) {
+        Arena* arena = &arenas[i];
+        LOCK(&arena->lock);
+        for (size_t bin = 0; bin < NUM_BINS; ++bin) {
+            stats->allocs[bin] += arena->allocs[bin];
+            stats->frees[bin] += arena->frees[bin];
+        }
+        stats->heapBytes += arena->heapBytes;
+        stats->bytesFree += arena->freeBytes;
+        stats->freeBlocks += arena->freeBlocks;
+        stats->bytesInUse += arena->heapBytes - arena->freeBytes
+            - (arena->freeBlocks + 2 * arena->fences) * sizeof(Block);
+        stats->splits += arena->splits;
+        stats->coalesces += arena->coalesces;
+        stats->remoteFrees += arena->remoteFrees;
+        if (arena->longestScan > stats->longestScan) {
+            stats->longestScan = arena->longestScan;
+        }
+        size_t largest = arena_largest_free(arena);
+        if (largest > stats->largestFree) {
+            stats->largestFree = largest;
+        }
+        UNLOCK(&arena->lock);
     }
-    newBlock->size = size;
 
-    // aplit the block
-    if (allocSize > size) {
-        Block* remainingBlock = (Block*)((char*)newBlock + sizeof(Block) + size);
-        remainingBlock->size = allocSize - size - sizeof(Block);
-        remainingBlock->next = head;
-        head = remainingBlock;
+    LOCK(&cacheListLock);
+#ifdef KU_THREAD_SAFE
+    for (ThreadCache* cache = cacheList; cache != NULL; cache = cache->next) {
+        stats_add_cache(stats, cache);
     }
+#ifdef KU_PER_CPU_CACHE
+    for (unsigned int i = 0; i < cpuCount; ++i) {
+        stats_add_cache(stats, &cpuCaches[i]);
+    }
+#endif
+#else
+    stats_add_cache(stats, &threadCache);
+#endif
+    stats_add_cache(stats, &retiredCaches);
+    UNLOCK(&cacheListLock);
 
-    return (void*)(newBlock + 1);
+    for (size_t bin = 0; bin < NUM_BINS; ++bin) {
+        stats->allocs[bin] += __atomic_load_n(&globalStats.allocs[bin], __ATOMIC_RELAXED);
+        stats->frees[bin] += __atomic_load_n(&globalStats.frees[bin], __ATOMIC_RELAXED);
+    }
+    LOCK(&heapLock);
+    stats->sbrkCalls = globalStats.sbrkCalls;
+    UNLOCK(&heapLock);
+    stats->mmapCalls = __atomic_load_n(&globalStats.mmapCalls, __ATOMIC_RELAXED);
+    stats->mmapBytes = __atomic_load_n(&globalStats.mmapBytes, __ATOMIC_RELAXED);
+    stats->smallBytes = __atomic_load_n(&globalStats.smallBytes, __ATOMIC_RELAXED);
+    stats->nurseryBytes = __atomic_load_n(&globalStats.nurseryBytes, __ATOMIC_RELAXED);
+    stats->bytesInUse += stats->mmapBytes + stats->smallBytes + stats->nurseryBytes;
+    stats->fragmentation = stats->bytesFree ? 1.0 - (double)stats->largestFree / stats->bytesFree : 0.0;
+    kumalloc_scavenge_stats(&stats->scavenge);
 }
 
-void *kucalloc(size_t nmemb, size_t size) {
-    size_t totalSize = nmemb * size;
-    void* ptr = kumalloc(totalSize);
-    if (ptr != NULL) {
-        // Zero-initialize the allocated block
-        for (size_t i = 0; i < totalSize; ++i) {
-            ((char*)ptr)[i] = 0;
+/*
+ * With KUMALLOC_STATS set in the environment the counters are printed to
+ * stderr at exit. The report goes through a stack buffer and write(2) so it
+ * does not allocate, even when this file is the system allocator.
+ */
+static void stats_print(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void stats_print(const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        write(STDERR_FILENO, line, length < (int)sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+}
+
+static void stats_dump(void) {
+    KuMallocStats stats;
+    kumalloc_stats(&stats);
+    stats_print("kumalloc: %zu bytes in use, %zu bytes free in %zu blocks, largest free %zu (fragmentation %.1f%%)\n",
+        stats.bytesInUse, stats.bytesFree, stats.freeBlocks, stats.largestFree, stats.fragmentation * 100.0);
+    stats_print("kumalloc: heap %zu bytes, mapped %zu bytes, small-object runs %zu bytes, nursery %zu bytes, %zu sbrk calls, %zu mmap calls\n",
+        stats.heapBytes, stats.mmapBytes, stats.smallBytes, stats.nurseryBytes, stats.sbrkCalls, stats.mmapCalls);
+    stats_print("kumalloc: %zu splits, %zu coalesces, longest scan %zu, scavenged %zu bytes, trimmed %zu bytes\n",
+        stats.splits, stats.coalesces, stats.longestScan, stats.scavenge.releasedBytes, stats.scavenge.trimmedBytes);
+    stats_print("kumalloc: %zu blocks freed from another arena's thread\n", stats.remoteFrees);
+    KuPolicy policy = __atomic_load_n(&placementPolicy, __ATOMIC_RELAXED);
+    if (policy != KU_POLICY_ADAPTIVE) {
+        stats_print("kumalloc: placement %s\n", policyNames[policy]);
+    } else {
+        PolicyRange* ranges = arenas[0].ranges;
+        stats_print("kumalloc: placement adaptive, first arena uses %s/%s/%s/%s below 64/512/4096 bytes/above\n",
+            policyNames[range_policy(&ranges[0])], policyNames[range_policy(&ranges[1])],
+            policyNames[range_policy(&ranges[2])], policyNames[range_policy(&ranges[3])]);
+    }
+    for (size_t bin = 0; bin < NUM_BINS; ++bin) {
+        if (stats.allocs[bin] || stats.frees[bin]) {
+            size_t low = bin < NUM_SMALL_BINS ? (bin + 1) * sizeof(Block) : (size_t)SMALL_BIN_LIMIT << (bin - NUM_SMALL_BINS);
+            stats_print("kumalloc: class %2zu (%zu+ bytes): %zu allocs, %zu frees\n", bin, low, stats.allocs[bin], stats.frees[bin]);
         }
     }
-    return ptr;
 }
-void kufree(void *ptr) {
+
+__attribute__((constructor)) static void stats_dump_register(void) {
+    const char* value = getenv("KUMALLOC_STATS");
+    if (value != NULL && *value != '\0' && *value != '0') {
+        atexit(stats_dump);
+    }
+}
+
+/*
+ * Heap walk. Each arena region runs from its marker to a fence, the only
+ * zero-sized blocks, so the walk follows the marker chain and steps through
+ * a region by block size. Slabs and nursery chunks come last, one entry
+ * each with its count of live objects. Remote frees are drained first so
+ * they show as free; blocks held by thread caches are still allocated as
+ * far as the arena knows and show as in use.
+ */
+static KuHeapState block_state(Arena* arena, Block* block) {
+    if (!(block->size & BLOCK_FREE)) {
+        return KU_HEAP_IN_USE;
+    }
+    if (block == arena->top) {
+        return KU_HEAP_TOP;
+    }
+    if (BLOCK_SIZE(block) >= SCAVENGE_MIN_SPAN && SPAN_RELEASED(block)) {
+        return KU_HEAP_RELEASED;
+    }
+    return KU_HEAP_FREE;
+}
+
+int kuheap_walk(KuHeapWalker walker, void* arg) {
+    arena_get(); // make sure the locks exist
+    KuHeapBlock info = {0};
+    int stop = 0;
+    for (int i = 0; i < KU_NUM_ARENAS && !stop; ++i) {
+        Arena* arena = &arenas[i];
+        LOCK(&arena->lock);
+        arena_drain_remote(arena);
+        for (Block* marker = arena->regions; marker != NULL && !stop; marker = marker->prevRegion) {
+            for (Block* block = marker + 1; BLOCK_SIZE(block) != 0 && !stop; block = BLOCK_NEXT(block)) {
+                info.address = block;
+                info.size = sizeof(Block) + BLOCK_SIZE(block);
+                info.state = block_state(arena, block);
+                info.arena = i;
+                stop = walker(&info, arg);
+            }
+        }
+        UNLOCK(&arena->lock);
+    }
+
+    LOCK(&mapLock);
+    for (size_t i = 0; i < mappedCount && !stop; ++i) {
+        Block* block = mappedBlocks[i];
+        info.address = MMAP_BASE(block);
+        info.size = (char*)BLOCK_NEXT(block) - MMAP_BASE(block);
+        info.state = KU_HEAP_MAPPED;
+        info.arena = -1;
+        stop = walker(&info, arg);
+    }
+    UNLOCK(&mapLock);
+
+#ifdef KU_SMALL_OBJECTS
+    if (!stop) {
+        stop = small_walk(walker, arg);
+    }
+#endif
+#ifdef KU_NURSERY
+    if (!stop) {
+        stop = nursery_walk(walker, arg);
+    }
+#endif
+    return stop;
+}
+
+/*
+ * Fixed-size slab allocator. Every slab is a slabBytes-aligned run of pages
+ * (one page unless fewer than SLAB_MIN_OBJECTS objects would fit) that starts
+ * with a SlabPage header followed by equal slots. Free slots are linked
+ * through their first word and never-used ones are handed out from a bump
+ * pointer, so objects carry no header and the owning slab of any object is
+ * found by masking its address. Slabs are mapped SLAB_BATCH at a time and
+ * up to SLAB_EMPTY_KEEP empty ones are kept for reuse, the rest are unmapped.
+ */
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_BATCH 16
+#define SLAB_EMPTY_KEEP 2
+// largest object whose slabs, a batch of them and the alignment slack still
+// have sizes that fit in a size_t
+#define SLAB_MAX_OBJECT (SIZE_MAX / (4 * SLAB_MIN_OBJECTS * (SLAB_BATCH + 1)))
+
+typedef struct SlabPage {
+    struct SlabPage* next;
+    struct SlabPage* prev;
+    void* freeList;     // slots freed back to this slab
+    char* bump;         // first slot never handed out
+    unsigned int inUse;
+} SlabPage;
+
+struct KuSlab {
+    Lock lock;
+    size_t objSize;
+    size_t slabBytes;
+    size_t firstOffset;   // offset of the first slot from the slab start
+    unsigned int perSlab;
+    SlabPage* partial;    // slabs with at least one free slot
+    SlabPage* full;
+    SlabPage* empty;
+    unsigned int emptyCount;
+    char* fresh;          // mapped slabs that were never used
+    char* freshEnd;
+    unsigned char mapClass;  // page map tag of a small-object slab, 0 otherwise
+};
+
+static void slab_list_push(SlabPage** list, SlabPage* page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list) {
+        (*list)->prev = page;
+    }
+    *list = page;
+}
+
+static void slab_list_remove(SlabPage** list, SlabPage* page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+}
+
+// map SLAB_BATCH slabs aligned to slabBytes
+static int slab_map_batch(KuSlab* slab) {
+    size_t bytes = slab->slabBytes * SLAB_BATCH;
+    size_t slack = slab->slabBytes - page_size();
+    char* memory = mmap(NULL, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return 0;
+    }
+    char* start = (char*)(((uintptr_t)memory + slab->slabBytes - 1) & ~(uintptr_t)(slab->slabBytes - 1));
+    if (start > memory) {
+        munmap(memory, start - memory);
+    }
+    if (memory + slack > start) {
+        munmap(start + bytes, memory + slack - start);
+    }
+    slab->fresh = start;
+    slab->freshEnd = start + bytes;
+#ifdef KU_SMALL_OBJECTS
+    if (slab->mapClass) {
+        pagemap_set(start, bytes, slab->mapClass);
+        STAT_ADD(globalStats.smallBytes, bytes);
+    }
+#endif
+    return 1;
+}
+
+// an empty slab, recycled or new, NULL when out of memory
+static SlabPage* slab_new_page(KuSlab* slab) {
+    SlabPage* page = slab->empty;
+    if (page) {
+        slab_list_remove(&slab->empty, page);
+        slab->emptyCount--;
+        return page;
+    }
+    if (slab->fresh == slab->freshEnd && !slab_map_batch(slab)) {
+        return NULL;
+    }
+    page = (SlabPage*)slab->fresh;
+    slab->fresh += slab->slabBytes;
+    page->freeList = NULL;
+    page->bump = (char*)page + slab->firstOffset;
+    page->inUse = 0;
+    return page;
+}
+
+// lay out a zeroed slab, slabs are at least minBytes (a power of two)
+static void slab_setup(KuSlab* slab, size_t objSize, size_t align, size_t minBytes) {
+    LOCK_INIT(&slab->lock);
+    // every slot must hold the free list link and keep the next one aligned
+    slab->objSize = objSize < sizeof(void*) ? sizeof(void*) : objSize;
+    slab->objSize = (slab->objSize + align - 1) & ~(align - 1);
+    slab->firstOffset = (sizeof(SlabPage) + align - 1) & ~(align - 1);
+    slab->slabBytes = minBytes > page_size() ? minBytes : page_size();
+    while ((slab->slabBytes - slab->firstOffset) / slab->objSize < SLAB_MIN_OBJECTS) {
+        slab->slabBytes *= 2;
+    }
+    slab->perSlab = (slab->slabBytes - slab->firstOffset) / slab->objSize;
+}
+
+KuSlab* kuslab_create(size_t objSize, size_t align) {
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    if ((align & (align - 1)) != 0 || align > page_size() || objSize == 0 || objSize > SLAB_MAX_OBJECT) {
+        return NULL;
+    }
+
+    KuSlab* slab = kumalloc(sizeof(KuSlab));
+    if (slab == NULL) {
+        return NULL;
+    }
+    memset(slab, 0, sizeof(KuSlab));
+    slab_setup(slab, objSize, align, page_size());
+    return slab;
+}
+
+// one object from slab, the slab lock must be held
+static void* slab_take(KuSlab* slab) {
+    SlabPage* page = slab->partial;
+    if (page == NULL) {
+        page = slab_new_page(slab);
+        if (page == NULL) {
+            return NULL;
+        }
+        slab_list_push(&slab->partial, page);
+    }
+
+    void* object = page->freeList;
+    if (object) {
+        page->freeList = *(void**)object;
+    } else {
+        object = page->bump;
+        page->bump += slab->objSize;
+    }
+    if (++page->inUse == slab->perSlab) {
+        slab_list_remove(&slab->partial, page);
+        slab_list_push(&slab->full, page);
+    }
+    return object;
+}
+
+void* kuslab_alloc(KuSlab* slab) {
+    LOCK(&slab->lock);
+    void* object = slab_take(slab);
+    UNLOCK(&slab->lock);
+    return object;
+}
+
+// give an object back to its slab, the slab lock must be held
+static void slab_put(KuSlab* slab, void* ptr) {
+    SlabPage* page = (SlabPage*)((uintptr_t)ptr & ~(uintptr_t)(slab->slabBytes - 1));
+    *(void**)ptr = page->freeList;
+    page->freeList = ptr;
+    if (page->inUse-- == slab->perSlab) {
+        slab_list_remove(&slab->full, page);
+        slab_list_push(&slab->partial, page);
+    }
+    if (page->inUse == 0) {
+        slab_list_remove(&slab->partial, page);
+        if (slab->emptyCount < SLAB_EMPTY_KEEP) {
+            slab_list_push(&slab->empty, page);
+            slab->emptyCount++;
+        } else {
+#ifdef KU_SMALL_OBJECTS
+            if (slab->mapClass) {
+                // no lookup can hit the run any more, it holds no objects
+                pagemap_set(page, slab->slabBytes, 0);
+                STAT_ADD(globalStats.smallBytes, -slab->slabBytes);
+            }
+#endif
+            munmap(page, slab->slabBytes);
+        }
+    }
+}
+
+void kuslab_free(KuSlab* slab, void* ptr) {
     if (ptr == NULL) {
         return;
     }
+    LOCK(&slab->lock);
+    slab_put(slab, ptr);
+    UNLOCK(&slab->lock);
+}
+
+static void slab_unmap_list(KuSlab* slab, SlabPage* page) {
+    while (page) {
+        SlabPage* next = page->next;
+        munmap(page, slab->slabBytes);
+        page = next;
+    }
+}
+
+void kuslab_destroy(KuSlab* slab) {
+    if (slab == NULL) {
+        return;
+    }
+    slab_unmap_list(slab, slab->partial);
+    slab_unmap_list(slab, slab->full);
+    slab_unmap_list(slab, slab->empty);
+    if (slab->fresh < slab->freshEnd) {
+        munmap(slab->fresh, slab->freshEnd - slab->fresh);
+    }
+    kufree(slab);
+}
 
-    Block *blockToFree = (Block *)((char *)ptr - sizeof(Block));
+#ifdef KU_SMALL_OBJECTS
+/*
+ * The page map covers a 48-bit address space in SMALL_RUN_BYTES runs: the
+ * root indexes the top bits and each leaf holds one byte per run, the size
+ * class plus one of a small-object run or 0. Leaves are mapped on demand and
+ * published with a compare-and-swap, lookups are two plain loads.
+ */
+#define PAGEMAP_LEAF_BITS 16
+#define PAGEMAP_ROOT_BITS (48 - SMALL_RUN_SHIFT - PAGEMAP_LEAF_BITS)
+#define PAGEMAP_LEAF_MASK (((uintptr_t)1 << PAGEMAP_LEAF_BITS) - 1)
+#define PAGEMAP_ROOT_MASK (((uintptr_t)1 << PAGEMAP_ROOT_BITS) - 1)
 
-    // coalesce with next block if possible
-    Block *current = head;
-    Block *prev = NULL;
-    while (current != NULL) {
-        if ((char *)blockToFree + sizeof(Block) + blockToFree->size == (char *)current) {
-            // merge with next block
-            blockToFree->size += sizeof(Block) + current->size;
-            blockToFree->next = current->next;
-            if (prev != NULL) {
-                prev->next = blockToFree;
+static unsigned char* pageMap[(size_t)1 << PAGEMAP_ROOT_BITS];
+static KuSlab smallSlabs[SMALL_OBJECT_CLASSES];
+
+static void pagemap_set(void* start, size_t bytes, unsigned char tag) {
+    uintptr_t first = (uintptr_t)start >> SMALL_RUN_SHIFT;
+    uintptr_t last = ((uintptr_t)start + bytes - 1) >> SMALL_RUN_SHIFT;
+    for (uintptr_t run = first; run <= last; ++run) {
+        unsigned char** slot = &pageMap[(run >> PAGEMAP_LEAF_BITS) & PAGEMAP_ROOT_MASK];
+        unsigned char* leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (leaf == NULL) {
+            unsigned char* fresh = mmap(NULL, (size_t)1 << PAGEMAP_LEAF_BITS, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (fresh == MAP_FAILED) {
+                abort(); // a run without an entry would be freed as a block
+            }
+            leaf = NULL;
+            if (__atomic_compare_exchange_n(slot, &leaf, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                leaf = fresh;
             } else {
-                head = blockToFree;
+                munmap(fresh, (size_t)1 << PAGEMAP_LEAF_BITS);
             }
-            return;
         }
-        prev = current;
-        current = current->next;
+        leaf[run & PAGEMAP_LEAF_MASK] = tag;
     }
+}
 
-    // add the block to the start of the free list
-    blockToFree->next = head;
-    head = blockToFree;
+// size class plus one of a headerless object, 0 for anything else
+static size_t small_class(const void* ptr) {
+    uintptr_t run = (uintptr_t)ptr >> SMALL_RUN_SHIFT;
+    unsigned char* leaf = pageMap[(run >> PAGEMAP_LEAF_BITS) & PAGEMAP_ROOT_MASK];
+    return leaf ? leaf[run & PAGEMAP_LEAF_MASK] : 0;
 }
 
+static void small_init(void) {
+    for (size_t i = 0; i < SMALL_OBJECT_CLASSES; ++i) {
+        slab_setup(&smallSlabs[i], (i + 1) * sizeof(Block), sizeof(Block), SMALL_RUN_BYTES);
+        smallSlabs[i].mapClass = (unsigned char)(i + 1);
+    }
+}
 
-void *kurealloc(void *ptr, size_t size)
-{
+#ifdef KU_THREAD_SAFE
+static void small_lock_all(void) {
+    for (size_t i = 0; i < SMALL_OBJECT_CLASSES; ++i) {
+        LOCK(&smallSlabs[i].lock);
+    }
+}
 
-   if (ptr == NULL) {
-        return kumalloc(size);
+static void small_unlock_all(void) {
+    for (size_t i = SMALL_OBJECT_CLASSES; i-- > 0;) {
+        UNLOCK(&smallSlabs[i].lock);
     }
+}
+#endif
 
-    Block* block = (Block*)((char*)ptr - sizeof(Block));
+// the thread cache keeps headerless objects linked through their first word
+static void small_push(ThreadCache* cache, size_t index, void* object) {
+    *(void**)object = cache->objects[index];
+    cache->objects[index] = object;
+    cache->objectCounts[index]++;
+}
+
+static void* small_pop(ThreadCache* cache, size_t index) {
+    void* object = cache->objects[index];
+    cache->objects[index] = *(void**)object;
+    cache->objectCounts[index]--;
+    return object;
+}
 
-    // if the new size is smaller split the block
-    if (block->size > size) {
-        size_t remainingSize = block->size - size;
-        if (remainingSize > sizeof(Block)) {
-            Block* newBlock = (Block*)((char*)block + sizeof(Block) + size);
-            newBlock->size = remainingSize - sizeof(Block);
-            newBlock->next = block->next;
-            block->size = size;
-            block->next = newBlock;
+// fill an empty list with up to TCACHE_BATCH objects and return one of them
+static void* small_refill(ThreadCache* cache, size_t index) {
+    arena_get(); // sets up the thread-exit flush and, threaded, the slabs
+    KuSlab* slab = &smallSlabs[index];
+    if (slab->objSize == 0) {
+        small_init();
+    }
+    int batch = CACHE_DEAD(cache) ? 1 : TCACHE_BATCH;
+    LOCK(&slab->lock);
+    void* object = slab_take(slab);
+    for (int i = 1; object != NULL && i < batch; ++i) {
+        void* extra = slab_take(slab);
+        if (extra == NULL) {
+            break;
         }
-        return ptr;
+        small_push(cache, index, extra);
     }
+    UNLOCK(&slab->lock);
+    return object;
+}
 
-    // if the new size is larger try to extend the block
-    if (block->size < size) {
-        // allocate a new block
-        void* newPtr = kumalloc(size);
-        if (newPtr != NULL) {
-            // copy the contents from the old block to the new block
-            memcpy(newPtr, ptr, block->size);
-            // free the old block
-            kufree(ptr);
-            return newPtr;
-        } else {
-            return NULL; 
+static void small_drain(ThreadCache* cache, size_t index, unsigned int count) {
+    KuSlab* slab = &smallSlabs[index];
+    LOCK(&slab->lock);
+    while (count-- > 0 && cache->objects[index] != NULL) {
+        slab_put(slab, small_pop(cache, index));
+    }
+    UNLOCK(&slab->lock);
+}
+
+static void* small_alloc(size_t index) {
+    ThreadCache* cache = cache_acquire();
+    void* object = cache->objects[index] != NULL
+        ? small_pop(cache, index)
+        : small_refill(cache, index);
+    cache->allocs[index]++;
+    if (CACHE_DEAD(cache)) {
+        tcache_retire_late(index);
+    }
+    cache_release(cache);
+    return object;
+}
+
+static void small_free(void* ptr, size_t index) {
+    ThreadCache* cache = cache_acquire();
+    small_push(cache, index, ptr);
+    cache->frees[index]++;
+    if (cache->objectCounts[index] > TCACHE_HIGH_WATER || CACHE_DEAD(cache)) {
+        small_drain(cache, index, TCACHE_BATCH);
+    }
+    if (CACHE_DEAD(cache)) {
+        tcache_retire_late(index);
+    }
+    cache_release(cache);
+}
+
+// report every slab of the size classes, mapped but never used ones as one
+// span without objects
+static int small_walk(KuHeapWalker walker, void* arg) {
+    KuHeapBlock info = {.state = KU_HEAP_SLAB, .arena = -1};
+    int stop = 0;
+    for (size_t i = 0; i < SMALL_OBJECT_CLASSES && !stop; ++i) {
+        KuSlab* slab = &smallSlabs[i];
+        LOCK(&slab->lock);
+        SlabPage* lists[] = {slab->partial, slab->full, slab->empty};
+        for (size_t list = 0; list < sizeof(lists) / sizeof(lists[0]) && !stop; ++list) {
+            for (SlabPage* page = lists[list]; page != NULL && !stop; page = page->next) {
+                info.address = page;
+                info.size = slab->slabBytes;
+                info.objects = page->inUse;
+                stop = walker(&info, arg);
+            }
         }
+        if (!stop && slab->fresh < slab->freshEnd) {
+            info.address = slab->fresh;
+            info.size = slab->freshEnd - slab->fresh;
+            info.objects = 0;
+            stop = walker(&info, arg);
+        }
+        UNLOCK(&slab->lock);
+    }
+    return stop;
+}
+#endif
+
+/*
+ * Region allocator for data that dies together. Allocation bumps a pointer
+ * through the newest chunk and chains a new chunk (at least chunkSize bytes,
+ * taken from kumalloc) when it runs out. Nothing is freed one by one:
+ * kuarena_rewind drops everything allocated after a mark and kuarena_reset
+ * drops everything while keeping the oldest chunk for the next phase.
+ * A KuArena is not locked, it belongs to one thread at a time.
+ */
+#define KUARENA_CHUNK_SIZE (64 * 1024)
+#define KUARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* prev;  // older chunk
+    char* end;
+} ArenaChunk;
+
+#define CHUNK_HEADER ((sizeof(ArenaChunk) + KUARENA_ALIGN - 1) & ~(size_t)(KUARENA_ALIGN - 1))
+#define CHUNK_START(chunk) ((char*)(chunk) + CHUNK_HEADER)
+
+struct KuArena {
+    ArenaChunk* chunk;  // newest chunk, NULL before the first allocation
+    char* top;          // next free byte in chunk
+    size_t chunkSize;
+};
+
+KuArena* kuarena_create(size_t chunkSize) {
+    KuArena* arena = kumalloc(sizeof(KuArena));
+    if (arena == NULL) {
+        return NULL;
     }
+    arena->chunk = NULL;
+    arena->top = NULL;
+    arena->chunkSize = chunkSize ? chunkSize : KUARENA_CHUNK_SIZE;
+    return arena;
+}
 
-    return ptr;
+void* kuarena_alloc(KuArena* arena, size_t size) {
+    // size 0, and sizes that rounding would wrap to 0, would hand out the
+    // current top, the same address as the next allocation
+    if (size == 0 || size > SIZE_MAX - (KUARENA_ALIGN - 1)) {
+        return NULL;
+    }
+    size = (size + KUARENA_ALIGN - 1) & ~(size_t)(KUARENA_ALIGN - 1);
+    if (arena->chunk && (size_t)(arena->chunk->end - arena->top) >= size) {
+        void* ptr = arena->top;
+        arena->top += size;
+        return ptr;
+    }
+    if (size > SIZE_MAX - arena->chunkSize) {
+        return NULL;
+    }
+
+    size_t bytes = CHUNK_HEADER + size;
+    if (bytes < arena->chunkSize) {
+        bytes = arena->chunkSize;
+    }
+    ArenaChunk* chunk = kumalloc(bytes);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->prev = arena->chunk;
+    chunk->end = (char*)chunk + bytes;
+    arena->chunk = chunk;
+    arena->top = CHUNK_START(chunk) + size;
+    return CHUNK_START(chunk);
+}
+
+KuArenaMark kuarena_mark(KuArena* arena) {
+    KuArenaMark mark = {arena->chunk, arena->top};
+    return mark;
+}
+
+void kuarena_rewind(KuArena* arena, KuArenaMark mark) {
+    while (arena->chunk != mark.chunk) {
+        ArenaChunk* prev = arena->chunk->prev;
+        kufree(arena->chunk);
+        arena->chunk = prev;
+    }
+    arena->top = mark.top;
+}
+
+void kuarena_reset(KuArena* arena) {
+    if (arena->chunk == NULL) {
+        return;
+    }
+    while (arena->chunk->prev) {
+        ArenaChunk* prev = arena->chunk->prev;
+        kufree(arena->chunk);
+        arena->chunk = prev;
+    }
+    arena->top = CHUNK_START(arena->chunk);
+}
+
+void kuarena_destroy(KuArena* arena) {
+    if (arena == NULL) {
+        return;
+    }
+    KuArenaMark empty = {NULL, NULL};
+    kuarena_rewind(arena, empty);
+    kufree(arena);
 }
 
 /*
- * Enable the code below to enable system allocator support for your allocator.
- * Doing so will make debugging much harder (e.g., using printf may result in
- * infinite loops).
+ * Build with -DKU_SYSTEM_ALLOCATOR (make build/libkumalloc.so) to replace
+ * the C library allocator, directly or through LD_PRELOAD. These are the
+ * entry points glibc documents for a replacement malloc. Nothing on the
+ * allocation path goes through dlsym or stdio, so the first call can come
+ * from the dynamic linker or from stdio setup without recursing; it only
+ * initialises the arenas. Unlike kumalloc, a zero-byte request gets a unique
+ * pointer like it would from glibc, since callers commonly take NULL as
+ * out of memory.
  */
-#if 0
-void *malloc(size_t size) { return kumalloc(size); }
-void *calloc(size_t nmemb, size_t size) { return kucalloc(nmemb, size); }
-void *realloc(void *ptr, size_t size) { return kurealloc(ptr, size); }
+#ifdef KU_SYSTEM_ALLOCATOR
+static void* system_memalign(size_t alignment, size_t size) {
+    return kumemalign(alignment < sizeof(Block) ? sizeof(Block) : alignment, size ? size : 1);
+}
+
+void *malloc(size_t size) {
+    void* ptr = kumalloc(size ? size : 1);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (nmemb == 0 || size == 0) {
+        nmemb = size = 1;
+    }
+    void* ptr = kucalloc(nmemb, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    void* newPtr = kurealloc(ptr, size);
+    if (newPtr == NULL && size != 0) {
+        errno = ENOMEM;
+    }
+    return newPtr;
+}
+
 void free(void *ptr) { kufree(ptr); }
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* ptr = system_memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* ptr = system_memalign(alignment, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    // like glibc, round an alignment that is not a power of two up to one
+    if (alignment & (alignment - 1)) {
+        if (alignment > SIZE_MAX / 2) {
+            errno = EINVAL;
+            return NULL;
+        }
+        alignment = (size_t)1 << (64 - __builtin_clzll((unsigned long long)alignment));
+    }
+    void* ptr = system_memalign(alignment, size);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *valloc(size_t size) {
+    return memalign(page_size(), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t pageMask = page_size() - 1;
+    if (size > SIZE_MAX - pageMask) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page_size(), size ? (size + pageMask) & ~pageMask : page_size());
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return kumalloc_usable_size(ptr);
+}
 #endif
\ No newline at end of file
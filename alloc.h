@@ -0,0 +1,160 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *kumalloc(size_t size);
+void *kucalloc(size_t nmemb, size_t size);
+void kufree(void *ptr);
+void *kurealloc(void *ptr, size_t size);
+// alignment must be a power of two, NULL on bad arguments or size 0
+void *kumemalign(size_t alignment, size_t size);
+// returns 0, EINVAL or ENOMEM like posix_memalign, *memptr is NULL for size 0
+int kuposix_memalign(void **memptr, size_t alignment, size_t size);
+void *kualigned_alloc(size_t alignment, size_t size);
+// bytes usable at ptr, at least what was asked for, 0 for NULL
+size_t kumalloc_usable_size(void *ptr);
+
+// n blocks of size bytes carved together, returns how many were stored in
+// out, fewer than n only when memory ran out
+size_t kumalloc_batch(size_t n, size_t size, void **out);
+// frees every pointer in ptrs (NULL entries are skipped), sorting the array
+// by address so neighbouring blocks are merged in one step
+void kufree_batch(size_t n, void **ptrs);
+// ptr must come from kumalloc, kucalloc or kumalloc_batch called with size
+void kufree_sized(void *ptr, size_t size);
+
+// requests of at least this many bytes get their own mmap (default 128 KiB)
+void kumalloc_set_mmap_threshold(size_t bytes);
+
+/*
+ * Free-block placement. KUMALLOC_POLICY=first (or next, best, worst,
+ * address, good, hybrid, adaptive) picks one at startup; adaptive chooses
+ * among first, best, worst and good per size range from the fragmentation
+ * and search lengths it observes.
+ */
+typedef enum KuPolicy {
+    KU_POLICY_HYBRID,   // first-fit below 64 bytes, worst-fit above (default)
+    KU_POLICY_FIRST,
+    KU_POLICY_NEXT,     // first-fit resuming where the last search stopped
+    KU_POLICY_BEST,
+    KU_POLICY_WORST,
+    KU_POLICY_ADDRESS,  // lowest-addressed fitting block
+    KU_POLICY_GOOD,     // first block within 1/8 of the request, else best-fit
+    KU_POLICY_ADAPTIVE,
+} KuPolicy;
+
+// returns 0, or -1 for an unknown policy
+int kumalloc_set_policy(KuPolicy policy);
+
+typedef struct KuScavengeStats {
+    size_t releasedBytes;  // interior pages of idle free spans given to madvise
+    size_t trimmedBytes;   // bytes given back by shrinking the program break
+    size_t passes;
+} KuScavengeStats;
+
+// release all free pages now keeping pad bytes at the heap top, returns bytes
+size_t kumalloc_trim(size_t pad);
+// free spans idle for this long are released (default 1000 ms, 0 disables)
+void kumalloc_set_scavenge_interval(unsigned int ms);
+void kumalloc_scavenge_stats(KuScavengeStats *stats);
+
+/*
+ * Size classes used by the statistics: class i < 32 holds blocks of exactly
+ * 16 * (i + 1) bytes, class i >= 32 holds blocks of [512 << (i - 32),
+ * 1024 << (i - 32)) bytes.
+ */
+#define KU_STATS_CLASSES 87
+
+typedef struct KuMallocStats {
+    size_t allocs[KU_STATS_CLASSES];
+    size_t frees[KU_STATS_CLASSES];
+    size_t bytesInUse;     // allocated blocks with their headers, mappings included
+    size_t bytesFree;      // payload bytes of free blocks
+    size_t freeBlocks;
+    size_t largestFree;
+    double fragmentation;  // 1 - largestFree / bytesFree
+    size_t heapBytes;      // memory currently obtained through sbrk
+    size_t mmapBytes;      // memory currently mapped for large blocks
+    size_t smallBytes;     // runs mapped for headerless small objects (KU_SMALL_OBJECTS)
+    size_t nurseryBytes;   // bump-pointer chunks for short-lived objects (KU_NURSERY)
+    size_t sbrkCalls;
+    size_t mmapCalls;
+    size_t splits;
+    size_t coalesces;
+    size_t longestScan;    // most free blocks looked at by a single search
+    size_t remoteFrees;    // blocks freed by a thread on another arena and drained by the owner
+    KuScavengeStats scavenge;
+} KuMallocStats;
+
+// snapshot of the counters, set KUMALLOC_STATS=1 to print them at exit
+void kumalloc_stats(KuMallocStats *stats);
+
+typedef enum KuHeapState {
+    KU_HEAP_IN_USE,    // allocated, or parked in a thread cache
+    KU_HEAP_FREE,
+    KU_HEAP_TOP,       // an arena's free top chunk
+    KU_HEAP_RELEASED,  // free span whose interior pages were given back
+    KU_HEAP_MAPPED,    // block with its own mapping
+    KU_HEAP_SLAB,      // slab of headerless small objects (KU_SMALL_OBJECTS)
+    KU_HEAP_NURSERY,   // bump-pointer chunk (KU_NURSERY)
+} KuHeapState;
+
+typedef struct KuHeapBlock {
+    void *address;         // block header, or start of the mapping, slab or chunk
+    size_t size;           // bytes up to the next block, header included
+    KuHeapState state;
+    int arena;             // owning arena, -1 outside the arenas
+    unsigned int objects;  // objects in use, slabs and nursery chunks only
+} KuHeapBlock;
+
+typedef int (*KuHeapWalker)(const KuHeapBlock *block, void *arg);
+
+/*
+ * Calls walker for every block of every arena region in address order
+ * within a region, then for every mapped block, small-object slab and
+ * nursery chunk. A nonzero return stops the walk and is returned. The
+ * walker runs with allocator locks held and must not allocate or free
+ * through kumalloc.
+ */
+int kuheap_walk(KuHeapWalker walker, void *arg);
+
+// pool of equally sized objects with no per-object header
+typedef struct KuSlab KuSlab;
+
+// align must be a power of two no larger than a page, NULL on bad arguments
+KuSlab *kuslab_create(size_t objSize, size_t align);
+void *kuslab_alloc(KuSlab *slab);
+void kuslab_free(KuSlab *slab, void *ptr);
+// unmaps every slab, objects still allocated from it become invalid
+void kuslab_destroy(KuSlab *slab);
+
+// bump-pointer region, everything in it is released together
+typedef struct KuArena KuArena;
+
+typedef struct KuArenaMark {
+    void *chunk;
+    char *top;
+} KuArenaMark;
+
+// chunkSize 0 picks the default (64 KiB)
+KuArena *kuarena_create(size_t chunkSize);
+// 16-byte aligned, valid until the region is reset or rewound past it,
+// NULL for size 0
+void *kuarena_alloc(KuArena *arena, size_t size);
+KuArenaMark kuarena_mark(KuArena *arena);
+// drop everything allocated since mark was taken
+void kuarena_rewind(KuArena *arena, KuArenaMark mark);
+// drop everything, keeping one chunk for reuse
+void kuarena_reset(KuArena *arena);
+void kuarena_destroy(KuArena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
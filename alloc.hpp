@@ -0,0 +1,292 @@
+#ifndef ALLOC_HPP
+#define ALLOC_HPP
+
+/*
+ * C++ front end for kumalloc, for code that wants the allocator without
+ * replacing malloc for the whole process. alloc.c stays C: build it with
+ * gcc (with -DKU_THREAD_SAFE if several threads allocate) and link it in.
+ *
+ *   ku::kumalloc_resource()   memory_resource on kumalloc/kufree_sized
+ *   ku::monotonic_resource    memory_resource on a KuArena
+ *   ku::pool_resource         memory_resource with a free list per size class
+ *   ku::allocator<T>          stateless allocator for the std containers
+ *
+ * Linking alloc_new.cpp as well sends every new and delete of the program
+ * through kumalloc.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include "alloc.h"
+
+namespace ku {
+
+// kumalloc payloads are aligned to its 16-byte headers
+constexpr std::size_t min_alignment = 16;
+
+namespace detail {
+
+// NULL when memory ran out, size 0 gets a block of its own like operator new
+inline void *try_allocate(std::size_t bytes, std::size_t alignment) noexcept {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    return alignment <= min_alignment ? kumalloc(bytes) : kumemalign(alignment, bytes);
+}
+
+inline void *allocate(std::size_t bytes, std::size_t alignment) {
+    void *ptr = try_allocate(bytes, alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+// bytes and alignment must be what the block was allocated with
+inline void deallocate(void *ptr, std::size_t bytes, std::size_t alignment) noexcept {
+    if (alignment <= min_alignment) {
+        kufree_sized(ptr, bytes ? bytes : 1);
+    } else {
+        // kufree_sized would take an aligned block for a plain one
+        kufree(ptr);
+    }
+}
+
+}  // namespace detail
+
+class heap_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        detail::deallocate(ptr, bytes, alignment);
+    }
+
+    // every heap_resource hands out the same heap
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const heap_resource *>(&other) != nullptr;
+    }
+};
+
+// the kumalloc counterpart of std::pmr::new_delete_resource()
+inline std::pmr::memory_resource *kumalloc_resource() noexcept {
+    static heap_resource resource;
+    return &resource;
+}
+
+/*
+ * Bump allocation out of a KuArena. deallocate does nothing, memory comes
+ * back when release() resets the arena or the resource is destroyed, so it
+ * suits containers built for one phase and dropped together. Not locked,
+ * like the arena it belongs to one thread at a time.
+ */
+class monotonic_resource : public std::pmr::memory_resource {
+public:
+    // chunkSize 0 picks the arena default (64 KiB)
+    explicit monotonic_resource(std::size_t chunkSize = 0) : arena_(kuarena_create(chunkSize)) {
+        if (arena_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    monotonic_resource(const monotonic_resource &) = delete;
+    monotonic_resource &operator=(const monotonic_resource &) = delete;
+
+    ~monotonic_resource() override {
+        kuarena_destroy(arena_);
+    }
+
+    // drop everything, keeping one chunk for the next phase
+    void release() noexcept {
+        kuarena_reset(arena_);
+    }
+
+    KuArena *arena() const noexcept {
+        return arena_;
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes > SIZE_MAX / 2 || alignment > SIZE_MAX / 2) {
+            throw std::bad_alloc();
+        }
+        // the arena aligns to 16, anything stricter is padded in front
+        std::size_t pad = alignment > min_alignment ? alignment - min_alignment : 0;
+        void *ptr = kuarena_alloc(arena_, (bytes ? bytes : 1) + pad);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(ptr);
+        return reinterpret_cast<void *>((address + alignment - 1) & ~(std::uintptr_t)(alignment - 1));
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    KuArena *arena_;
+};
+
+/*
+ * Free list per exact size class of alloc.h (16 * (i + 1) bytes up to 512),
+ * refilled by carving chunks from upstream, so node-based containers reuse
+ * their nodes without a call into the allocator. Chunks of a class start at
+ * 16 objects and double up to 64 KiB; larger or over-aligned requests go
+ * straight to upstream. Memory goes back upstream on release() or
+ * destruction. Not locked, one thread at a time.
+ */
+class pool_resource : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t classes = 32;
+    static constexpr std::size_t largest = min_alignment * classes;
+
+    explicit pool_resource(std::pmr::memory_resource *upstream = kumalloc_resource()) noexcept
+        : upstream_(upstream) {
+    }
+
+    pool_resource(const pool_resource &) = delete;
+    pool_resource &operator=(const pool_resource &) = delete;
+
+    ~pool_resource() override {
+        release();
+    }
+
+    // give every chunk back, objects still allocated from them become invalid
+    void release() noexcept {
+        while (chunks_ != nullptr) {
+            Chunk *next = chunks_->next;
+            upstream_->deallocate(chunks_, chunks_->bytes, min_alignment);
+            chunks_ = next;
+        }
+        for (std::size_t i = 0; i < classes; ++i) {
+            free_[i] = nullptr;
+            refill_[i] = 0;
+        }
+    }
+
+    std::pmr::memory_resource *upstream_resource() const noexcept {
+        return upstream_;
+    }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes > largest || alignment > min_alignment) {
+            return upstream_->allocate(bytes, alignment);
+        }
+        std::size_t index = class_of(bytes);
+        Node *node = free_[index];
+        if (node == nullptr) {
+            return refill(index);
+        }
+        free_[index] = node->next;
+        return node;
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        if (bytes > largest || alignment > min_alignment) {
+            upstream_->deallocate(ptr, bytes, alignment);
+            return;
+        }
+        std::size_t index = class_of(bytes);
+        Node *node = static_cast<Node *>(ptr);
+        node->next = free_[index];
+        free_[index] = node;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    struct Node {
+        Node *next;
+    };
+
+    struct alignas(min_alignment) Chunk {
+        Chunk *next;
+        std::size_t bytes;  // as handed to upstream, header included
+    };
+
+    static constexpr std::size_t first_refill = 16;
+    static constexpr std::size_t chunk_limit = 64 * 1024;
+
+    static std::size_t class_of(std::size_t bytes) noexcept {
+        return bytes ? (bytes - 1) / min_alignment : 0;
+    }
+
+    // carve a new chunk for class index, hand out its first object
+    void *refill(std::size_t index) {
+        std::size_t size = (index + 1) * min_alignment;
+        std::size_t count = refill_[index] ? refill_[index] : first_refill;
+        std::size_t bytes = sizeof(Chunk) + count * size;
+        Chunk *chunk = static_cast<Chunk *>(upstream_->allocate(bytes, min_alignment));
+        chunk->next = chunks_;
+        chunk->bytes = bytes;
+        chunks_ = chunk;
+        if (count * 2 * size <= chunk_limit) {
+            refill_[index] = count * 2;
+        } else {
+            refill_[index] = count;
+        }
+
+        char *first = reinterpret_cast<char *>(chunk + 1);
+        Node *list = nullptr;
+        for (std::size_t i = count - 1; i > 0; --i) {
+            Node *node = reinterpret_cast<Node *>(first + i * size);
+            node->next = list;
+            list = node;
+        }
+        free_[index] = list;
+        return first;
+    }
+
+    std::pmr::memory_resource *upstream_;
+    Chunk *chunks_ = nullptr;
+    Node *free_[classes] = {};
+    std::size_t refill_[classes] = {};  // objects in the next chunk, 0 before the first
+};
+
+// stateless allocator for std::vector, std::unordered_map and friends
+template <class T>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U> &) noexcept {
+    }
+
+    T *allocate(std::size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(detail::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        detail::deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+}  // namespace ku
+
+#endif  // ALLOC_HPP
@@ -0,0 +1,120 @@
+/*
+ * Replacements for the global operator new and delete, sized and aligned
+ * forms included, so a C++ program linked with this file allocates through
+ * kumalloc without preloading libkumalloc.so. Sized deletes go to
+ * kufree_sized, which skips the header lookup for cached sizes.
+ *
+ *   gcc -O2 -DKU_THREAD_SAFE -c alloc.c
+ *   g++ -O2 -std=c++17 -I. app.cpp alloc_new.cpp alloc.o -pthread
+ */
+#include <cstddef>
+#include <new>
+#include "alloc.hpp"
+
+namespace {
+
+// what the standard asks of operator new: retry through the new handler,
+// throw once there is none
+void *allocate_or_throw(std::size_t size, std::size_t alignment) {
+    for (;;) {
+        void *ptr = ku::detail::try_allocate(size, alignment);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void *allocate_or_null(std::size_t size, std::size_t alignment) noexcept {
+    try {
+        return allocate_or_throw(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size) {
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept {
+    kufree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    kufree(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    kufree(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    kufree(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept {
+    ku::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept {
+    ku::detail::deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    kufree(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+    kufree(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size, std::align_val_t alignment) noexcept {
+    ku::detail::deallocate(ptr, size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete[](void *ptr, std::size_t size, std::align_val_t alignment) noexcept {
+    ku::detail::deallocate(ptr, size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    kufree(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    kufree(ptr);
+}
@@ -0,0 +1,89 @@
+/*
+ * Bulk allocation benchmark, kumalloc_batch/kufree_batch against one call
+ * per object.
+ *
+ * Each round allocates BATCH objects of one size, shuffles the pointers (the
+ * order a worklist tends to drop them in) and frees them all, per object with
+ * kufree or kufree_sized, or with a single kufree_batch. Sizes below the
+ * thread cache limit and above it are measured separately. Reports ns per
+ * object including the release.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -I. bench/batch_bench.c alloc.c -o batch_bench
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "alloc.h"
+
+#define ROUNDS 20000
+#define BATCH 256
+
+static const size_t sizes[] = {48, 200, 1000, 4000};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void shuffle(void **objects) {
+    for (int i = BATCH - 1; i > 0; --i) {
+        int j = (int)(next_random() % (uint64_t)(i + 1));
+        void *swap = objects[i];
+        objects[i] = objects[j];
+        objects[j] = swap;
+    }
+}
+
+enum { PER_OBJECT, SIZED, BATCHED };
+
+static double bench(size_t size, int mode) {
+    void *objects[BATCH];
+    double start = now_ns();
+    for (int round = 0; round < ROUNDS; ++round) {
+        if (mode == BATCHED) {
+            kumalloc_batch(BATCH, size, objects);
+        } else {
+            for (int i = 0; i < BATCH; ++i) {
+                objects[i] = kumalloc(size);
+            }
+        }
+        for (int i = 0; i < BATCH; ++i) {
+            memset(objects[i], i, 16);
+        }
+        shuffle(objects);
+        if (mode == BATCHED) {
+            kufree_batch(BATCH, objects);
+        } else if (mode == SIZED) {
+            for (int i = 0; i < BATCH; ++i) {
+                kufree_sized(objects[i], size);
+            }
+        } else {
+            for (int i = 0; i < BATCH; ++i) {
+                kufree(objects[i]);
+            }
+        }
+    }
+    return (now_ns() - start) / ((double)ROUNDS * BATCH);
+}
+
+int main(void) {
+    printf("%-8s %14s %14s %14s\n", "size", "kufree", "kufree_sized", "batch");
+    for (size_t i = 0; i < NUM_SIZES; ++i) {
+        printf("%-8zu %14.2f %14.2f %14.2f\n", sizes[i],
+               bench(sizes[i], PER_OBJECT), bench(sizes[i], SIZED), bench(sizes[i], BATCHED));
+    }
+    return 0;
+}
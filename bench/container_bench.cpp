@@ -0,0 +1,182 @@
+/*
+ * Container benchmark, the C++ front end of alloc.hpp against the default
+ * allocator (std::allocator on the C library malloc).
+ *
+ * Each workload runs the same container code once per heap: std::allocator,
+ * ku::allocator, and polymorphic allocators on ku::pool_resource and on
+ * ku::monotonic_resource (released after every round). The workloads are a
+ * growing vector, list churn, and inserting and erasing random keys in a
+ * map and an unordered_map. Reports ns per element operation.
+ *
+ * Build from the repository root (alloc.c stays C):
+ *   gcc -O2 -c alloc.c -o alloc.o
+ *   g++ -O2 -std=c++17 -I. bench/container_bench.cpp alloc.o -o container_bench
+ */
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include "alloc.hpp"
+
+#define ROUNDS 400
+#define ELEMENTS 2000
+
+static std::uint64_t rng = 0x9e3779b97f4a7c15ULL;
+static volatile long sink;
+
+static std::uint64_t next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct DefaultHeap {
+    std::allocator<char> get() {
+        return {};
+    }
+    void reset() {
+    }
+};
+
+struct KuHeap {
+    ku::allocator<char> get() {
+        return {};
+    }
+    void reset() {
+    }
+};
+
+struct PoolHeap {
+    ku::pool_resource pool;
+    std::pmr::polymorphic_allocator<char> get() {
+        return &pool;
+    }
+    void reset() {
+    }
+};
+
+struct MonotonicHeap {
+    ku::monotonic_resource arena;
+    std::pmr::polymorphic_allocator<char> get() {
+        return &arena;
+    }
+    void reset() {
+        arena.release();
+    }
+};
+
+template <class Heap, class T>
+using Alloc = typename std::allocator_traits<decltype(std::declval<Heap &>().get())>::template rebind_alloc<T>;
+
+// push_back from empty, the vector doubles its way up
+template <class Heap>
+static double vector_growth(Heap &heap) {
+    double start = now_ns();
+    for (int round = 0; round < ROUNDS; ++round) {
+        {
+            std::vector<long, Alloc<Heap, long>> vec(heap.get());
+            for (int i = 0; i < ELEMENTS; ++i) {
+                vec.push_back(i);
+            }
+            sink = vec.back();
+        }
+        heap.reset();
+    }
+    return (now_ns() - start) / ((double)ROUNDS * ELEMENTS);
+}
+
+// fill, drop every other node, refill the gaps, clear
+template <class Heap>
+static double list_churn(Heap &heap) {
+    double start = now_ns();
+    for (int round = 0; round < ROUNDS; ++round) {
+        {
+            std::list<long, Alloc<Heap, long>> list(heap.get());
+            for (int i = 0; i < ELEMENTS; ++i) {
+                list.push_back(i);
+            }
+            for (auto it = list.begin(); it != list.end(); ++it) {
+                it = list.erase(it);
+                list.insert(it, -1);
+            }
+            sink = list.front();
+        }
+        heap.reset();
+    }
+    return (now_ns() - start) / ((double)ROUNDS * ELEMENTS * 2);
+}
+
+// insert random keys, then erase them in insertion order
+template <class Map, class Heap>
+static double map_churn(Heap &heap) {
+    std::vector<long> keys(ELEMENTS);
+    double start = now_ns();
+    for (int round = 0; round < ROUNDS; ++round) {
+        {
+            Map map(heap.get());
+            for (int i = 0; i < ELEMENTS; ++i) {
+                keys[i] = (long)(next_random() >> 1);
+                map.emplace(keys[i], i);
+            }
+            for (int i = 0; i < ELEMENTS; ++i) {
+                map.erase(keys[i]);
+            }
+            sink = (long)map.size();
+        }
+        heap.reset();
+    }
+    return (now_ns() - start) / ((double)ROUNDS * ELEMENTS * 2);
+}
+
+template <class Heap>
+static double ordered_map(Heap &heap) {
+    return map_churn<std::map<long, long, std::less<long>, Alloc<Heap, std::pair<const long, long>>>>(heap);
+}
+
+template <class Heap>
+static double unordered_map(Heap &heap) {
+    using Map = std::unordered_map<long, long, std::hash<long>, std::equal_to<long>,
+                                   Alloc<Heap, std::pair<const long, long>>>;
+    return map_churn<Map>(heap);
+}
+
+template <class Heap>
+static void run(Heap &heap, double *results) {
+    results[0] = vector_growth(heap);
+    results[1] = list_churn(heap);
+    results[2] = ordered_map(heap);
+    results[3] = unordered_map(heap);
+}
+
+int main() {
+    static const char *workloads[] = {"vector growth", "list churn", "map", "unordered_map"};
+    double results[4][4];
+    DefaultHeap defaultHeap;
+    KuHeap kuHeap;
+    PoolHeap poolHeap;
+    MonotonicHeap monotonicHeap;
+    run(defaultHeap, results[0]);
+    run(kuHeap, results[1]);
+    run(poolHeap, results[2]);
+    run(monotonicHeap, results[3]);
+
+    std::printf("%-16s %10s %14s %10s %14s\n", "ns/element", "default", "ku::allocator", "ku::pool",
+                "ku::monotonic");
+    for (int i = 0; i < 4; ++i) {
+        std::printf("%-16s %10.2f %14.2f %10.2f %14.2f\n", workloads[i], results[0][i], results[1][i],
+                    results[2][i], results[3][i]);
+    }
+    return 0;
+}
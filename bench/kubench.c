@@ -0,0 +1,406 @@
+/*
+ * Allocator benchmark suite: runs kumalloc/kufree/kurealloc and glibc
+ * malloc/free/realloc through the same synthetic workloads.
+ *
+ *   uniform   random replacement in a window, sizes uniform in [16, 4096]
+ *   powerlaw  random replacement, sizes heavy-tailed from 16 bytes to 256 KiB
+ *   lifo      allocate a batch then free it newest first
+ *   fifo      free the oldest object once the window is full
+ *   larson    producer threads allocate, consumer threads free
+ *   realloc   buffers grown a few bytes at a time, interleaved
+ *   fragment  free every other block, then ask for bigger blocks
+ *
+ * Every (allocator, workload) pair runs in a forked child so peak RSS is its
+ * own. One JSON object per line goes to stdout: ops/sec over the whole run,
+ * p50/p99 latency from every LATENCY_SAMPLE-th operation, and peak RSS.
+ *
+ * Usage: kubench [ops-per-workload] [workload]
+ * Built and run by `make bench`, which writes bench_output.txt. With
+ * KUMALLOC_POLICY set the kumalloc rows are named kumalloc:<policy>, `make
+ * bench-policies` runs every placement policy into policy_output.txt.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc.h"
+
+#define DEFAULT_OPS 2000000
+#define LATENCY_SAMPLE 16
+#define MAX_SAMPLES (1 << 20)
+#define WINDOW 8192
+#define LARSON_PAIRS 2
+#define LARSON_QUEUE 1024
+
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*release)(void *);
+    void *(*resize)(void *, size_t);
+} Allocator;
+
+// per-thread operation count and sampled latencies
+typedef struct {
+    long ops;
+    long samples;
+    uint32_t latency[MAX_SAMPLES / LARSON_PAIRS];
+} Recorder;
+
+typedef struct {
+    double opsPerSec;
+    double p50;
+    double p99;
+    long ops;
+} Result;
+
+static long opsPerWorkload = DEFAULT_OPS;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static size_t uniform_size(uint64_t *state) {
+    return 16 + next_random(state) % (4096 - 16 + 1);
+}
+
+// Pareto-like: most requests are tiny, a few are hundreds of KiB
+static size_t powerlaw_size(uint64_t *state) {
+    double u = (double)((next_random(state) >> 11) + 1) / (double)(1ULL << 53);
+    double size = 16.0 / (u * u);
+    return size > 256 * 1024 ? 256 * 1024 : (size_t)size;
+}
+
+/*
+ * Every allocator call goes through these so that one in LATENCY_SAMPLE of
+ * them is timed without the clock dominating the rest.
+ */
+static void *timed_alloc(const Allocator *allocator, Recorder *rec, size_t size) {
+    void *ptr;
+    if (rec->ops++ % LATENCY_SAMPLE == 0 && rec->samples < (long)(sizeof(rec->latency) / sizeof(rec->latency[0]))) {
+        uint64_t start = now_ns();
+        ptr = allocator->alloc(size);
+        rec->latency[rec->samples++] = (uint32_t)(now_ns() - start);
+    } else {
+        ptr = allocator->alloc(size);
+    }
+    if (ptr) {
+        *(volatile char *)ptr = 1; // make sure the memory is really there
+    }
+    return ptr;
+}
+
+static void timed_free(const Allocator *allocator, Recorder *rec, void *ptr) {
+    if (rec->ops++ % LATENCY_SAMPLE == 0 && rec->samples < (long)(sizeof(rec->latency) / sizeof(rec->latency[0]))) {
+        uint64_t start = now_ns();
+        allocator->release(ptr);
+        rec->latency[rec->samples++] = (uint32_t)(now_ns() - start);
+    } else {
+        allocator->release(ptr);
+    }
+}
+
+static void *timed_realloc(const Allocator *allocator, Recorder *rec, void *ptr, size_t size) {
+    void *moved;
+    if (rec->ops++ % LATENCY_SAMPLE == 0 && rec->samples < (long)(sizeof(rec->latency) / sizeof(rec->latency[0]))) {
+        uint64_t start = now_ns();
+        moved = allocator->resize(ptr, size);
+        rec->latency[rec->samples++] = (uint32_t)(now_ns() - start);
+    } else {
+        moved = allocator->resize(ptr, size);
+    }
+    return moved;
+}
+
+static void run_replace(const Allocator *allocator, Recorder *rec, size_t (*size_of)(uint64_t *)) {
+    static void *window[WINDOW];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    memset(window, 0, sizeof(window));
+    while (rec->ops < opsPerWorkload) {
+        size_t slot = next_random(&state) % WINDOW;
+        if (window[slot]) {
+            timed_free(allocator, rec, window[slot]);
+            window[slot] = NULL;
+        } else {
+            window[slot] = timed_alloc(allocator, rec, size_of(&state));
+        }
+    }
+    for (size_t slot = 0; slot < WINDOW; ++slot) {
+        allocator->release(window[slot]);
+    }
+}
+
+static void run_uniform(const Allocator *allocator, Recorder *rec) {
+    run_replace(allocator, rec, uniform_size);
+}
+
+static void run_powerlaw(const Allocator *allocator, Recorder *rec) {
+    run_replace(allocator, rec, powerlaw_size);
+}
+
+static void run_lifo(const Allocator *allocator, Recorder *rec) {
+    static void *stack[WINDOW];
+    uint64_t state = 42;
+    while (rec->ops < opsPerWorkload) {
+        size_t depth = 1 + next_random(&state) % WINDOW;
+        for (size_t i = 0; i < depth; ++i) {
+            stack[i] = timed_alloc(allocator, rec, 16 + next_random(&state) % 512);
+        }
+        while (depth-- > 0) {
+            timed_free(allocator, rec, stack[depth]);
+        }
+    }
+}
+
+static void run_fifo(const Allocator *allocator, Recorder *rec) {
+    static void *queue[WINDOW];
+    uint64_t state = 7;
+    size_t head = 0;
+    memset(queue, 0, sizeof(queue));
+    while (rec->ops < opsPerWorkload) {
+        if (queue[head]) {
+            timed_free(allocator, rec, queue[head]);
+        }
+        queue[head] = timed_alloc(allocator, rec, 16 + next_random(&state) % 512);
+        head = (head + 1) % WINDOW;
+    }
+    for (size_t slot = 0; slot < WINDOW; ++slot) {
+        allocator->release(queue[slot]);
+    }
+}
+
+/*
+ * Larson-style cross-thread traffic: each producer allocates objects and
+ * hands them to its consumer through a single-producer single-consumer ring,
+ * so every object is freed by a different thread than the one that made it.
+ */
+typedef struct {
+    const Allocator *allocator;
+    Recorder *rec;
+    void *ring[LARSON_QUEUE];
+    unsigned long head;  // written by the producer
+    unsigned long tail;  // written by the consumer
+    long count;
+} Channel;
+
+static void *larson_producer(void *arg) {
+    Channel *channel = arg;
+    uint64_t state = (uintptr_t)channel | 1;
+    for (long i = 0; i < channel->count; ++i) {
+        void *ptr = timed_alloc(channel->allocator, channel->rec, 16 + next_random(&state) % 1024);
+        unsigned long head = channel->head;
+        while (head - __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE) == LARSON_QUEUE) {
+            sched_yield();
+        }
+        channel->ring[head % LARSON_QUEUE] = ptr;
+        __atomic_store_n(&channel->head, head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *larson_consumer(void *arg) {
+    Channel *channel = arg;
+    Recorder *rec = channel->rec + 1;
+    for (long i = 0; i < channel->count; ++i) {
+        unsigned long tail = channel->tail;
+        while (__atomic_load_n(&channel->head, __ATOMIC_ACQUIRE) == tail) {
+            sched_yield();
+        }
+        timed_free(channel->allocator, rec, channel->ring[tail % LARSON_QUEUE]);
+        __atomic_store_n(&channel->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void run_larson(const Allocator *allocator, Recorder *rec) {
+    static Channel channels[LARSON_PAIRS];
+    static Recorder recorders[LARSON_PAIRS][2];
+    pthread_t threads[LARSON_PAIRS][2];
+
+    for (int i = 0; i < LARSON_PAIRS; ++i) {
+        memset(&channels[i], 0, sizeof(Channel));
+        memset(recorders[i], 0, sizeof(recorders[i]));
+        channels[i].allocator = allocator;
+        channels[i].rec = recorders[i];
+        channels[i].count = opsPerWorkload / (2 * LARSON_PAIRS);
+        pthread_create(&threads[i][0], NULL, larson_producer, &channels[i]);
+        pthread_create(&threads[i][1], NULL, larson_consumer, &channels[i]);
+    }
+    for (int i = 0; i < LARSON_PAIRS; ++i) {
+        pthread_join(threads[i][0], NULL);
+        pthread_join(threads[i][1], NULL);
+    }
+
+    // fold the per-thread recorders into the caller's
+    rec->ops = 0;
+    rec->samples = 0;
+    for (int i = 0; i < LARSON_PAIRS; ++i) {
+        for (int side = 0; side < 2; ++side) {
+            Recorder *part = &recorders[i][side];
+            long room = (long)(sizeof(rec->latency) / sizeof(rec->latency[0])) - rec->samples;
+            long take = part->samples < room ? part->samples : room;
+            memcpy(rec->latency + rec->samples, part->latency, take * sizeof(uint32_t));
+            rec->samples += take;
+            rec->ops += part->ops;
+        }
+    }
+}
+
+static void run_realloc(const Allocator *allocator, Recorder *rec) {
+    enum { BUFFERS = 64, LIMIT = 64 * 1024 };
+    static char *buffers[BUFFERS];
+    static size_t lengths[BUFFERS];
+    uint64_t state = 99;
+    memset(buffers, 0, sizeof(buffers));
+    memset(lengths, 0, sizeof(lengths));
+    while (rec->ops < opsPerWorkload) {
+        size_t i = next_random(&state) % BUFFERS;
+        if (lengths[i] >= LIMIT) {
+            timed_free(allocator, rec, buffers[i]);
+            buffers[i] = NULL;
+            lengths[i] = 0;
+            continue;
+        }
+        lengths[i] += 1 + next_random(&state) % 64;
+        buffers[i] = timed_realloc(allocator, rec, buffers[i], lengths[i]);
+        buffers[i][lengths[i] - 1] = (char)i;
+    }
+    for (size_t i = 0; i < BUFFERS; ++i) {
+        allocator->release(buffers[i]);
+    }
+}
+
+/*
+ * Fragmentation stress: fill the heap with mixed small blocks, free every
+ * other one and then request blocks too large for the holes. A heap that
+ * cannot reuse the holes shows up as a higher peak RSS.
+ */
+static void run_fragment(const Allocator *allocator, Recorder *rec) {
+    enum { BLOCKS = 65536 };
+    static void *blocks[BLOCKS];
+    uint64_t state = 1234;
+    while (rec->ops < opsPerWorkload) {
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            blocks[i] = timed_alloc(allocator, rec, 16 + next_random(&state) % 240);
+        }
+        for (size_t i = 0; i < BLOCKS; i += 2) {
+            timed_free(allocator, rec, blocks[i]);
+            blocks[i] = timed_alloc(allocator, rec, 300 + next_random(&state) % 700);
+        }
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            timed_free(allocator, rec, blocks[i]);
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(const Allocator *, Recorder *);
+} Workload;
+
+static const Workload workloads[] = {
+    {"uniform", run_uniform},
+    {"powerlaw", run_powerlaw},
+    {"lifo", run_lifo},
+    {"fifo", run_fifo},
+    {"larson", run_larson},
+    {"realloc", run_realloc},
+    {"fragment", run_fragment},
+};
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static Result measure(const Allocator *allocator, const Workload *workload) {
+    static Recorder rec;
+    Result result;
+    memset(&rec, 0, sizeof(rec));
+
+    uint64_t start = now_ns();
+    workload->run(allocator, &rec);
+    uint64_t elapsed = now_ns() - start;
+
+    qsort(rec.latency, rec.samples, sizeof(uint32_t), compare_u32);
+    result.ops = rec.ops;
+    result.opsPerSec = rec.ops / (elapsed / 1e9);
+    result.p50 = rec.samples ? rec.latency[rec.samples / 2] : 0;
+    result.p99 = rec.samples ? rec.latency[rec.samples * 99 / 100] : 0;
+    return result;
+}
+
+// run one pair in a child so ru_maxrss belongs to this workload alone
+static int run_child(const Allocator *allocator, const Workload *workload) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result result = measure(allocator, workload);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+
+    Result result;
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || got != sizeof(result)) {
+        fprintf(stderr, "kubench: %s/%s failed\n", allocator->name, workload->name);
+        return -1;
+    }
+    printf("{\"allocator\":\"%s\",\"workload\":\"%s\",\"ops\":%ld,\"ops_per_sec\":%.0f,"
+           "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"peak_rss_kb\":%ld}\n",
+           allocator->name, workload->name, result.ops, result.opsPerSec,
+           result.p50, result.p99, usage.ru_maxrss);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // kumalloc reads KUMALLOC_POLICY itself, the rows only carry its name
+    char kumallocName[64] = "kumalloc";
+    const char *policy = getenv("KUMALLOC_POLICY");
+    if (policy != NULL && *policy != '\0') {
+        snprintf(kumallocName, sizeof(kumallocName), "kumalloc:%s", policy);
+    }
+    const Allocator allocators[] = {
+        {kumallocName, kumalloc, kufree, kurealloc},
+        {"glibc", malloc, free, realloc},
+    };
+    if (argc > 1) {
+        opsPerWorkload = atol(argv[1]);
+    }
+    const char *only = argc > 2 ? argv[2] : NULL;
+
+    int failures = 0;
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+        if (only && strcmp(only, workloads[w].name) != 0) {
+            continue;
+        }
+        for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); ++a) {
+            failures += run_child(&allocators[a], &workloads[w]) != 0;
+        }
+    }
+    return failures != 0;
+}
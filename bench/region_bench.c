@@ -0,0 +1,65 @@
+/*
+ * Phase-scoped allocation benchmark, kuarena against per-object kufree.
+ *
+ * Each phase allocates the kind of objects parse_command builds for one
+ * prompt line (a handful of small strings and argv arrays) and then drops
+ * them all, either one kufree per object or a single kuarena_reset.
+ * Reports ns per object including the release.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -I. bench/region_bench.c alloc.c -o region_bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "alloc.h"
+
+#define PHASES 200000
+#define OBJECTS_PER_PHASE 48
+
+static const size_t sizes[] = {8, 12, 24, 7, 64, 16, 33, 120, 9, 40, 17, 256};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench_kufree(void) {
+    void *objects[OBJECTS_PER_PHASE];
+    double start = now_ns();
+    for (int phase = 0; phase < PHASES; ++phase) {
+        for (int i = 0; i < OBJECTS_PER_PHASE; ++i) {
+            size_t size = sizes[(phase + i) % NUM_SIZES];
+            objects[i] = kumalloc(size);
+            memset(objects[i], i, size);
+        }
+        for (int i = 0; i < OBJECTS_PER_PHASE; ++i) {
+            kufree(objects[i]);
+        }
+    }
+    return (now_ns() - start) / ((double)PHASES * OBJECTS_PER_PHASE);
+}
+
+static double bench_kuarena(void) {
+    KuArena *arena = kuarena_create(0);
+    double start = now_ns();
+    for (int phase = 0; phase < PHASES; ++phase) {
+        for (int i = 0; i < OBJECTS_PER_PHASE; ++i) {
+            size_t size = sizes[(phase + i) % NUM_SIZES];
+            memset(kuarena_alloc(arena, size), i, size);
+        }
+        kuarena_reset(arena);
+    }
+    double elapsed = now_ns() - start;
+    kuarena_destroy(arena);
+    return elapsed / ((double)PHASES * OBJECTS_PER_PHASE);
+}
+
+int main(void) {
+    printf("%-24s %10s\n", "release strategy", "ns/object");
+    printf("%-24s %10.2f\n", "kumalloc + kufree", bench_kufree());
+    printf("%-24s %10.2f\n", "kuarena + reset", bench_kuarena());
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Pointer-chasing benchmark for the huge-page mode.
+ *
+ * Allocates nodes one kumalloc at a time, links them in a random order and
+ * walks the chain, so nearly every hop lands on a different page. Built
+ * twice by `make bench`: tlb_bench with the default program-break heap and
+ * tlb_bench_huge with -DKU_HUGE_PAGES. Prints one JSON line with ns per hop,
+ * dTLB load misses per hop when perf_event_open is permitted (null
+ * otherwise) and how much of the process is backed by transparent huge
+ * pages.
+ *
+ * Usage: tlb_bench [nodes] [hops]
+ */
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc.h"
+
+#define DEFAULT_NODES (2L * 1024 * 1024)
+#define NODE_BYTES 48  // a 64-byte block with the header
+
+#ifdef KU_HUGE_PAGES
+#define HEAP_MODE "huge"
+#else
+#define HEAP_MODE "sbrk"
+#endif
+
+typedef struct Node {
+    struct Node *next;
+    char pad[NODE_BYTES - sizeof(struct Node *)];
+} Node;
+
+static uint64_t rng = 0x9e3779b97f4a7c15ULL;
+static Node *volatile sink;  // keeps the walk from being optimised away
+
+static uint64_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// counter for user-space dTLB load misses, -1 if the kernel refuses
+static int dtlb_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// AnonHugePages of the whole process in KiB
+static long anon_huge_kb(void) {
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+int main(int argc, char **argv) {
+    long nodes = argc > 1 ? atol(argv[1]) : DEFAULT_NODES;
+    if (nodes < 2) {
+        nodes = DEFAULT_NODES;
+    }
+    long hops = argc > 2 ? atol(argv[2]) : 4 * nodes;
+    if (hops <= 0) {
+        hops = 4 * nodes;
+    }
+
+    Node **order = malloc(nodes * sizeof(Node *));
+    if (order == NULL) {
+        fprintf(stderr, "tlb_bench: out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < nodes; ++i) {
+        order[i] = kumalloc(sizeof(Node));
+        if (order[i] == NULL) {
+            fprintf(stderr, "tlb_bench: kumalloc failed\n");
+            return 1;
+        }
+    }
+    // random cycle through every node
+    for (long i = nodes - 1; i > 0; --i) {
+        long j = (long)(next_random() % (uint64_t)(i + 1));
+        Node *swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (long i = 0; i < nodes; ++i) {
+        order[i]->next = order[(i + 1) % nodes];
+    }
+    Node *node = order[0];
+    free(order);
+
+    int fd = dtlb_open();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double start = now_ns();
+    for (long i = 0; i < hops; ++i) {
+        node = node->next;
+    }
+    double elapsed = now_ns() - start;
+    sink = node;
+    long long misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(fd);
+    }
+
+    printf("{\"heap\":\"%s\",\"nodes\":%ld,\"hops\":%ld,\"ns_per_hop\":%.2f,",
+           HEAP_MODE, nodes, hops, elapsed / hops);
+    if (misses >= 0) {
+        printf("\"dtlb_misses\":%lld,\"dtlb_misses_per_hop\":%.4f,", misses, (double)misses / hops);
+    } else {
+        printf("\"dtlb_misses\":null,\"dtlb_misses_per_hop\":null,");
+    }
+    printf("\"anon_huge_kb\":%ld}\n", anon_huge_kb());
+    return 0;
+}
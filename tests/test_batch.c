@@ -0,0 +1,67 @@
+#include <pthread.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define N 1000
+
+static void* ptrs[N + 64];
+
+// frees the main thread's blocks along with a few of its own in one batch
+static void* consumer(void* arg) {
+    (void)arg;
+    CHECK(kumalloc_batch(64, 700, ptrs + N) == 64);
+    kufree_batch(N + 64, ptrs);
+    return NULL;
+}
+
+int main(void) {
+    static const size_t sizes[] = {24, 200, 1000, 5000, 1 << 20};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t size = sizes[s];
+        size_t count = size > 100000 ? 4 : 300;
+        CHECK(kumalloc_batch(count, size, ptrs) == count);
+        for (size_t i = 0; i < count; ++i) {
+            CHECK(kumalloc_usable_size(ptrs[i]) >= size);
+            memset(ptrs[i], (int)i, size);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            unsigned char* p = ptrs[i];
+            CHECK(p[0] == (unsigned char)i && p[size - 1] == (unsigned char)i);
+        }
+        // NULL entries are skipped
+        ptrs[count / 2] = (kufree(ptrs[count / 2]), NULL);
+        kufree_batch(count, ptrs);
+    }
+    CHECK(kumalloc_batch(10, 0, ptrs) == 0);
+
+    // a run of neighbours merges back into one span
+    KuMallocStats before, after;
+    kumalloc_stats(&before);
+    CHECK(kumalloc_batch(40, 1000, ptrs) == 40);
+    kufree_batch(40, ptrs);
+    kumalloc_stats(&after);
+    CHECK(after.freeBlocks <= before.freeBlocks + 1);
+
+    // sized frees take the cache or the header path by size
+    void* small = kumalloc(100);
+    void* large = kumalloc(3000);
+    kufree_sized(small, 100);
+    kufree_sized(large, 3000);
+    kufree_sized(NULL, 10);
+    CHECK(kumalloc(100) == small);
+    kufree(small);
+
+    // blocks of another arena go through its remote list and drain back
+    kufree(kumalloc(700));
+    kumalloc_stats(&before);
+    CHECK(kumalloc_batch(N, 700, ptrs) == N);
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, consumer, NULL) == 0);
+    CHECK(pthread_join(thread, NULL) == 0);
+    kufree(kumalloc(5000));
+    kumalloc_stats(&after);
+    CHECK(after.remoteFrees - before.remoteFrees == N);
+    CHECK(after.bytesInUse <= before.bytesInUse);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+static const size_t sizes[] = {1, 24, 100, 500, 1000, 5000, 40000, 100000, 300000};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static int zeroed(const unsigned char* p, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(void) {
+    for (int round = 0; round < 3; ++round) {
+        // dirty memory of every size first, so kucalloc has recycled blocks
+        // as well as fresh ones to hand out
+        void* dirty[NUM_SIZES];
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            dirty[i] = kumalloc(sizes[i]);
+            CHECK(dirty[i] != NULL);
+            memset(dirty[i], 0xaa, sizes[i]);
+        }
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            kufree(dirty[i]);
+        }
+
+        unsigned char* zero[NUM_SIZES];
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            zero[i] = kucalloc(1, sizes[i]);
+            CHECK(zero[i] != NULL && zeroed(zero[i], sizes[i]));
+            memset(zero[i], 0xbb, sizes[i]);
+        }
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            kufree(zero[i]);
+        }
+
+        // a span that was freed whole, and then split up by kucalloc
+        unsigned char* pieces[16];
+        for (int i = 0; i < 16; ++i) {
+            pieces[i] = kucalloc(100, 37);
+            CHECK(pieces[i] != NULL && zeroed(pieces[i], 3700));
+        }
+        for (int i = 0; i < 16; ++i) {
+            memset(pieces[i], 0xcc, 3700);
+            kufree(pieces[i]);
+        }
+    }
+
+    // the element count times the element size must not wrap
+    CHECK(kucalloc(SIZE_MAX / 2, 3) == NULL);
+    CHECK(kucalloc((size_t)1 << 33, (size_t)1 << 33) == NULL);
+    CHECK(kucalloc(0, 10) == NULL);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define PART 40000
+
+int main(void) {
+    // three neighbours and a guard so nothing merges with what lies above
+    char* a = kumalloc(PART);
+    char* b = kumalloc(PART);
+    char* c = kumalloc(PART);
+    char* guard = kumalloc(PART);
+    CHECK(a != NULL && b != NULL && c != NULL && guard != NULL);
+    CHECK(b > a && c > b && guard > c);
+
+    // freeing the middle block last merges with the free blocks on both sides
+    kufree(a);
+    kufree(c);
+    kufree(b);
+    char* whole = kumalloc(3 * PART);
+    CHECK(whole == a);
+    memset(whole, 0x5a, 3 * PART);
+    kufree(whole);
+
+    // the same span again, merging backwards this time
+    a = kumalloc(PART);
+    b = kumalloc(PART);
+    CHECK(a == whole && b > a && b < guard);
+    kufree(b);
+    kufree(a);
+    CHECK(kumalloc(2 * PART) == whole);
+    kufree(whole);
+
+    // the guard itself is still intact and usable
+    memset(guard, 0x11, PART);
+    kufree(guard);
+    return 0;
+}
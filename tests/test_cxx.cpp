@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "alloc.hpp"
+#include "check.h"
+
+static std::size_t total(const std::size_t *counts) {
+    std::size_t sum = 0;
+    for (int i = 0; i < KU_STATS_CLASSES; ++i) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+struct alignas(64) Wide {
+    char bytes[64];
+};
+
+int main() {
+    // alloc_new.cpp sends plain, aligned and nothrow new through kumalloc
+    KuMallocStats before, after;
+    kumalloc_stats(&before);
+    int *plain = new int(7);
+    Wide *wide = new Wide[3];
+    char *nothrow = new (std::nothrow) char[100];
+    CHECK(plain != nullptr && wide != nullptr && nothrow != nullptr);
+    CHECK(reinterpret_cast<std::uintptr_t>(wide) % 64 == 0);
+    CHECK(kumalloc_usable_size(plain) >= sizeof(int));
+    kumalloc_stats(&after);
+    CHECK(total(after.allocs) - total(before.allocs) >= 3);
+    delete plain;
+    delete[] wide;
+    delete[] nothrow;
+    kumalloc_stats(&after);
+    CHECK(total(after.frees) - total(before.frees) >= 3);
+
+    // the std containers on ku::allocator
+    std::vector<int, ku::allocator<int>> numbers;
+    for (int i = 0; i < 100000; ++i) {
+        numbers.push_back(i);
+    }
+    std::map<int, int, std::less<int>, ku::allocator<std::pair<const int, int>>> ordered;
+    for (int i = 0; i < 5000; ++i) {
+        ordered[i * 7 % 5000] = i;
+    }
+    CHECK(ordered.size() == 5000);
+    for (int i = 0; i < 100000; ++i) {
+        CHECK(numbers[i] == i);
+    }
+    std::vector<Wide, ku::allocator<Wide>> wides(10);
+    CHECK(reinterpret_cast<std::uintptr_t>(wides.data()) % 64 == 0);
+
+    // every memory resource keeps its objects apart and aligned
+    ku::pool_resource pool;
+    ku::monotonic_resource monotonic;
+    std::pmr::memory_resource *resources[] = {ku::kumalloc_resource(), &pool, &monotonic};
+    for (std::pmr::memory_resource *resource : resources) {
+        std::pmr::list<std::pmr::string> words(resource);
+        std::pmr::unordered_map<int, std::pmr::string> table(resource);
+        for (int i = 0; i < 2000; ++i) {
+            words.emplace_back(std::to_string(i) + " some words to leave the short-string buffer");
+            table.emplace(i, words.back());
+        }
+        int i = 0;
+        for (const std::pmr::string &word : words) {
+            CHECK(table.at(i) == word);
+            CHECK(word.compare(0, std::to_string(i).size(), std::to_string(i)) == 0);
+            ++i;
+        }
+        void *zero = resource->allocate(0, 16);
+        void *other = resource->allocate(0, 16);
+        CHECK(zero != nullptr && zero != other);
+        resource->deallocate(zero, 0, 16);
+        resource->deallocate(other, 0, 16);
+        for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+            void *ptr = resource->allocate(100, alignment);
+            CHECK(reinterpret_cast<std::uintptr_t>(ptr) % alignment == 0);
+            std::memset(ptr, 0xee, 100);
+            resource->deallocate(ptr, 100, alignment);
+        }
+    }
+    CHECK(ku::kumalloc_resource()->is_equal(*ku::kumalloc_resource()));
+    CHECK(!pool.is_equal(monotonic));
+
+    // pool nodes are reused in place
+    void *node = pool.allocate(48, 16);
+    pool.deallocate(node, 48, 16);
+    CHECK(pool.allocate(48, 16) == node);
+    pool.release();
+    monotonic.release();
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include "alloc.h"
+#include "check.h"
+
+#define LIVE 2000
+#define HEADER 16
+
+typedef struct Totals {
+    size_t blocks;
+    size_t arenaBytes;
+    size_t freeBytes;
+    size_t freeBlocks;
+    size_t mappedBytes;
+    size_t slabBytes;
+    uintptr_t freeEnd;  // end of the last free block seen
+} Totals;
+
+static int add_block(const KuHeapBlock* block, void* arg) {
+    Totals* totals = arg;
+    totals->blocks++;
+    CHECK(block->size != 0 && block->size % HEADER == 0);
+    switch (block->state) {
+    case KU_HEAP_MAPPED:
+        totals->mappedBytes += block->size;
+        break;
+    case KU_HEAP_SLAB:
+        totals->slabBytes += block->size;
+        break;
+    default:
+        totals->arenaBytes += block->size;
+        if (block->state != KU_HEAP_IN_USE) {
+            // two free neighbours would be a missed merge
+            CHECK((uintptr_t)block->address != totals->freeEnd);
+            totals->freeEnd = (uintptr_t)block->address + block->size;
+            totals->freeBytes += block->size - HEADER;
+            totals->freeBlocks++;
+        }
+    }
+    return 0;
+}
+
+static int stop_early(const KuHeapBlock* block, void* arg) {
+    (void)block;
+    return ++*(int*)arg == 3 ? 42 : 0;
+}
+
+// the walk adds up to the same totals kumalloc_stats keeps
+static void check_walk(void) {
+    Totals totals = {0};
+    CHECK(kuheap_walk(add_block, &totals) == 0);
+    KuMallocStats stats;
+    kumalloc_stats(&stats);
+    // every region has a marker and a fence besides its blocks
+    CHECK(stats.heapBytes >= totals.arenaBytes);
+    CHECK((stats.heapBytes - totals.arenaBytes) % (2 * HEADER) == 0);
+    CHECK(totals.freeBytes == stats.bytesFree);
+    CHECK(totals.freeBlocks == stats.freeBlocks);
+    CHECK(totals.mappedBytes == stats.mmapBytes);
+    CHECK(totals.slabBytes == stats.smallBytes);
+}
+
+int main(void) {
+    static void* live[LIVE];
+    check_walk();
+    unsigned state = 5;
+    for (int op = 0; op < 200000; ++op) {
+        size_t slot = check_rand(&state) % LIVE;
+        unsigned r = check_rand(&state);
+        size_t size = r % 8 == 0 ? 1 + check_rand(&state) % 400000 : 1 + check_rand(&state) % 3000;
+        if (live[slot] != NULL && r % 5 == 1) {
+            live[slot] = kurealloc(live[slot], size);
+        } else if (live[slot] != NULL) {
+            kufree(live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = r % 7 == 2 ? kumemalign(4096, size) : kumalloc(size);
+        }
+    }
+    for (int slot = 0; slot < LIVE; slot += 2) {
+        kufree(live[slot]);
+    }
+    check_walk();
+    kumalloc_trim(0);
+    check_walk();
+
+    int calls = 0;
+    CHECK(kuheap_walk(stop_early, &calls) == 42);
+    CHECK(calls == 3);
+    return 0;
+}
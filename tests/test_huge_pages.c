@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define COUNT 20000
+#define SIZE 1000
+
+static char* blocks[COUNT];
+
+int main(void) {
+    KuMallocStats before, after;
+    char* brk = sbrk(0);
+    kumalloc_stats(&before);
+
+    // a buffer at the arena's top grows in place, the region is reserved
+    // up front and the extensions continue it
+    kumalloc_set_mmap_threshold((size_t)64 << 20);
+    char* keep = kumalloc(600);
+    char* buf = kumalloc(600);
+    char* first = buf;
+    for (size_t size = 608; size <= (1 << 20); size += 8) {
+        buf = kurealloc(buf, size);
+        CHECK(buf != NULL);
+    }
+    CHECK(buf == first);
+    kufree(buf);
+    kufree(keep);
+
+    // about 20 MB of heap blocks, none of it from the program break
+    for (int i = 0; i < COUNT; ++i) {
+        blocks[i] = kumalloc(SIZE);
+        CHECK(blocks[i] != NULL);
+        CHECK((uintptr_t)blocks[i] % 16 == 0);
+        memset(blocks[i], i, SIZE);
+    }
+    CHECK((char*)sbrk(0) == brk);
+    kumalloc_stats(&after);
+    CHECK(after.heapBytes - before.heapBytes >= (size_t)COUNT * SIZE);
+
+    // the arena bumps through 2 MiB regions, so it needs a handful of
+    // mappings rather than one per extension
+    CHECK(after.mmapCalls - before.mmapCalls <= 2 * (after.heapBytes >> 21) + 2);
+
+    // consecutive extensions of the arena stay contiguous
+    size_t stride = blocks[2] - blocks[1];
+    size_t adjacent = 0;
+    for (int i = 1; i < COUNT; ++i) {
+        adjacent += (size_t)(blocks[i] - blocks[i - 1]) == stride;
+    }
+    CHECK(adjacent > COUNT * 9 / 10);
+    for (int i = 0; i < COUNT; ++i) {
+        for (int j = 0; j < SIZE; j += 97) {
+            CHECK(blocks[i][j] == (char)i);
+        }
+        kufree(blocks[i]);
+    }
+
+    // and merge once freed, a megabyte fits without growing the heap
+    void* whole = kumalloc(1 << 20);
+    CHECK(whole != NULL);
+    kumalloc_stats(&before);
+    CHECK(before.heapBytes == after.heapBytes);
+    kufree(whole);
+
+    // nothing ends at the break, so there is no top to give back
+    kumalloc_trim(0);
+    CHECK((char*)sbrk(0) == brk);
+    return 0;
+}
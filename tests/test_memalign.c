@@ -0,0 +1,76 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+static const size_t sizes[] = {1, 24, 100, 1000, 5000, 70000, 300000};
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static size_t total(const size_t* counts) {
+    size_t sum = 0;
+    for (int i = 0; i < KU_STATS_CLASSES; ++i) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+int main(void) {
+    // every alignment from the header size to 1 MiB, with neighbours kept
+    // alive in between so the arenas have to cut aligned spots out of
+    // blocks instead of starting fresh
+    for (size_t align = 8; align <= ((size_t)1 << 20); align *= 2) {
+        void* kept[NUM_SIZES];
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            unsigned char* p = kumemalign(align, sizes[i]);
+            CHECK(p != NULL);
+            CHECK(((uintptr_t)p & (align - 1)) == 0);
+            CHECK(kumalloc_usable_size(p) >= sizes[i]);
+            memset(p, (int)i, sizes[i]);
+            kept[i] = kumalloc(sizes[i] % 3000 + 1);
+            CHECK(kept[i] != NULL);
+            kufree(p);
+        }
+        for (size_t i = 0; i < NUM_SIZES; ++i) {
+            kufree(kept[i]);
+        }
+    }
+
+    // aligned blocks behave like any other block afterwards
+    char* p = kumemalign(4096, 3000);
+    CHECK(p != NULL && ((uintptr_t)p & 4095) == 0);
+    memset(p, 0x42, 3000);
+    p = kurealloc(p, 20000);
+    CHECK(p != NULL);
+    for (int i = 0; i < 3000; ++i) {
+        CHECK(p[i] == 0x42);
+    }
+    kufree(p);
+
+    void* q = NULL;
+    CHECK(kuposix_memalign(&q, 64, 100) == 0);
+    CHECK(q != NULL && ((uintptr_t)q & 63) == 0);
+    kufree(q);
+    q = kualigned_alloc(128, 256);
+    CHECK(q != NULL && ((uintptr_t)q & 127) == 0);
+    kufree(q);
+
+    CHECK(kumemalign(0, 10) == NULL);
+    CHECK(kumemalign(48, 10) == NULL);
+    CHECK(kumemalign(64, 0) == NULL);
+    CHECK(kumemalign((size_t)1 << 62, 10) == NULL);
+    CHECK(kumemalign(64, SIZE_MAX - 10) == NULL);
+    CHECK(kuposix_memalign(&q, 24, 10) == EINVAL);
+    CHECK(kuposix_memalign(&q, 4, 10) == EINVAL);
+    CHECK(kuposix_memalign(&q, 64, 0) == 0 && q == NULL);
+    CHECK(kumalloc_usable_size(NULL) == 0);
+
+    // an aligned request the heap cannot grow for is not counted
+    KuMallocStats before, after;
+    kumalloc_set_mmap_threshold(SIZE_MAX);
+    kumalloc_stats(&before);
+    CHECK(kumemalign(4096, (size_t)1 << 50) == NULL);
+    kumalloc_stats(&after);
+    CHECK(total(after.allocs) == total(before.allocs));
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+// a mapped block's header sits at the start of its own page
+static int mapped(void* ptr) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return ((uintptr_t)ptr & (pageSize - 1)) == 16 && (char*)ptr > (char*)sbrk(0);
+}
+
+int main(void) {
+    char* big = kumalloc(1 << 20);
+    CHECK(big != NULL && mapped(big));
+    memset(big, 0x33, 1 << 20);
+    kufree(big);
+
+    // below the default threshold the arenas serve it
+    char* medium = kumalloc(100000);
+    CHECK(medium != NULL && !mapped(medium));
+    kufree(medium);
+
+    kumalloc_set_mmap_threshold(64 * 1024);
+    medium = kumalloc(100000);
+    CHECK(medium != NULL && mapped(medium));
+    memset(medium, 0x44, 100000);
+    kufree(medium);
+
+    kumalloc_set_mmap_threshold(4 << 20);
+    big = kumalloc(1 << 20);
+    CHECK(big != NULL && !mapped(big));
+    memset(big, 0x55, 1 << 20);
+    kufree(big);
+
+    // sizes near SIZE_MAX must fail instead of wrapping the page rounding
+    CHECK(kumalloc(SIZE_MAX - 100) == NULL);
+    return 0;
+}
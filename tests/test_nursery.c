@@ -0,0 +1,127 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define LIVE 512
+
+static pthread_key_t lateKey;
+
+// runs after the allocator's exit flush, must not take a nursery chunk
+// that nothing would let go of again
+static void late_destructor(void* value) {
+    kufree(value);
+    for (int i = 0; i < 100; ++i) {
+        kufree(kumalloc(64));
+    }
+}
+
+static void* worker(void* arg) {
+    void** handoff = arg;
+    void* objects[200];
+    for (int i = 0; i < 200; ++i) {
+        objects[i] = kumalloc(8 + i % 250);
+        CHECK(objects[i] != NULL);
+    }
+    for (int i = 1; i < 200; ++i) {
+        kufree(objects[i]);
+    }
+    // the main thread frees the last one, after this thread has gone
+    *handoff = objects[0];
+    pthread_setspecific(lateKey, kumalloc(100));
+    return NULL;
+}
+
+static int count_nursery(const KuHeapBlock* block, void* arg) {
+    if (block->state == KU_HEAP_NURSERY) {
+        *(size_t*)arg += block->objects;
+    }
+    return 0;
+}
+
+int main(void) {
+    KuMallocStats stats;
+
+    // short-lived objects come and go without the chunks piling up
+    for (int round = 0; round < 200; ++round) {
+        void* objects[100];
+        for (int i = 0; i < 100; ++i) {
+            objects[i] = kumalloc(1 + (round + i) % 256);
+            CHECK(objects[i] != NULL);
+            CHECK((uintptr_t)objects[i] % 16 == 0);
+            memset(objects[i], i, 1 + (round + i) % 256);
+        }
+        for (int i = 0; i < 100; ++i) {
+            kufree(objects[i]);
+        }
+    }
+    kumalloc_stats(&stats);
+    CHECK(stats.nurseryBytes > 0 && stats.nurseryBytes <= 2 * 64 * 1024);
+
+    // the walk sees live nursery objects
+    void* held = kumalloc(200);
+    size_t live = 0;
+    CHECK(kuheap_walk(count_nursery, &live) == 0);
+    CHECK(live >= 1);
+
+#ifdef KU_SMALL_OBJECTS
+    // requests the headerless slabs can take never reach the nursery
+    void* tiny = kumalloc(40);
+    size_t liveAfter = 0;
+    CHECK(kuheap_walk(count_nursery, &liveAfter) == 0);
+    CHECK(liveAfter == live);
+    kumalloc_stats(&stats);
+    CHECK(stats.smallBytes > 0);
+    kufree(tiny);
+#endif
+
+    // realloc moves objects out of the nursery and keeps their bytes
+    unsigned char* p = held;
+    memset(p, 0x5a, 40);
+    CHECK(kumalloc_usable_size(p) >= 40);
+    p = kurealloc(p, 5000);
+    CHECK(p != NULL);
+    for (int i = 0; i < 40; ++i) {
+        CHECK(p[i] == 0x5a);
+    }
+    kufree(p);
+
+    // random churn mixing nursery and heap sizes
+    static unsigned char* objects[LIVE];
+    static size_t sizes[LIVE];
+    unsigned state = 3;
+    for (int op = 0; op < 100000; ++op) {
+        size_t slot = check_rand(&state) % LIVE;
+        if (objects[slot] != NULL) {
+            for (size_t i = 0; i < sizes[slot]; ++i) {
+                CHECK(objects[slot][i] == (unsigned char)slot);
+            }
+            kufree(objects[slot]);
+        }
+        sizes[slot] = 1 + check_rand(&state) % 1000;
+        objects[slot] = kumalloc(sizes[slot]);
+        CHECK(objects[slot] != NULL);
+        memset(objects[slot], (int)slot, sizes[slot]);
+    }
+    for (int slot = 0; slot < LIVE; ++slot) {
+        kufree(objects[slot]);
+    }
+
+    // threads hand their chunks back at exit, objects freed later by
+    // another thread still recycle them, and TLS destructors that run
+    // after the flush stay out of the nursery
+    CHECK(pthread_key_create(&lateKey, late_destructor) == 0);
+    kumalloc_stats(&stats);
+    size_t nurseryBefore = stats.nurseryBytes;
+    for (int t = 0; t < 100; ++t) {
+        void* last = NULL;
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, worker, &last) == 0);
+        CHECK(pthread_join(thread, NULL) == 0);
+        kufree(last);
+    }
+    kumalloc_stats(&stats);
+    CHECK(stats.nurseryBytes <= nurseryBefore + 2 * 64 * 1024);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define IDLE_THREADS 100
+#define BLOCKS 64
+#define WORKERS 8
+
+static pthread_barrier_t done;
+
+// frees what it allocated and then stays alive, with per-thread caches the
+// blocks would stay parked in it until the thread exits
+static void* idler(void* arg) {
+    (void)arg;
+    void* blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; ++i) {
+        blocks[i] = kumalloc(16 + 16 * (i % 8));
+        CHECK(blocks[i] != NULL);
+    }
+    for (int i = 0; i < BLOCKS; ++i) {
+        kufree(blocks[i]);
+    }
+    pthread_barrier_wait(&done);
+    return NULL;
+}
+
+// threads share and migrate between the caches, so every block must keep
+// its bytes under churn from several of them
+static void* churner(void* arg) {
+    unsigned state = (unsigned)(size_t)arg + 1;
+    unsigned char* live[256] = {0};
+    size_t sizes[256];
+    for (int op = 0; op < 50000; ++op) {
+        size_t slot = check_rand(&state) % 256;
+        if (live[slot] != NULL) {
+            for (size_t i = 0; i < sizes[slot]; ++i) {
+                CHECK(live[slot][i] == (unsigned char)slot);
+            }
+            kufree(live[slot]);
+        }
+        sizes[slot] = 1 + check_rand(&state) % 600;
+        live[slot] = kumalloc(sizes[slot]);
+        CHECK(live[slot] != NULL);
+        memset(live[slot], (int)slot, sizes[slot]);
+    }
+    for (int slot = 0; slot < 256; ++slot) {
+        kufree(live[slot]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[IDLE_THREADS];
+
+    // one thread first to set the caches up, after that idle threads reuse
+    // the blocks the ones before them handed back
+    CHECK(pthread_barrier_init(&done, NULL, 1) == 0);
+    CHECK(pthread_create(&threads[0], NULL, idler, NULL) == 0);
+    CHECK(pthread_join(threads[0], NULL) == 0);
+    pthread_barrier_destroy(&done);
+
+    // the barrier opens once every thread has freed its blocks
+    CHECK(pthread_barrier_init(&done, NULL, IDLE_THREADS + 1) == 0);
+    char* before = sbrk(0);
+    for (int t = 0; t < IDLE_THREADS; ++t) {
+        CHECK(pthread_create(&threads[t], NULL, idler, NULL) == 0);
+    }
+    pthread_barrier_wait(&done);
+    CHECK((char*)sbrk(0) - before < 64 * 1024);
+    for (int t = 0; t < IDLE_THREADS; ++t) {
+        CHECK(pthread_join(threads[t], NULL) == 0);
+    }
+    pthread_barrier_destroy(&done);
+
+    for (int t = 0; t < WORKERS; ++t) {
+        CHECK(pthread_create(&threads[t], NULL, churner, (void*)(size_t)t) == 0);
+    }
+    for (int t = 0; t < WORKERS; ++t) {
+        CHECK(pthread_join(threads[t], NULL) == 0);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define PINNED 2000
+#define LIVE 1024
+
+static void* small[PINNED];
+static void* pins[PINNED];
+static unsigned char* live[LIVE];
+static size_t liveSize[LIVE];
+
+// two pinned holes of different sizes on a fresh heap, returns which one a
+// request took
+static int pick(KuPolicy policy) {
+    CHECK(kumalloc_set_policy(policy) == 0);
+    char* big = kumalloc(3000);
+    void* pinA = kumalloc(1000);
+    char* fit = kumalloc(1100);
+    void* pinB = kumalloc(1000);
+    kufree(big);
+    kufree(fit);
+    char* got = kumalloc(1000);
+    int which = got == big ? 'w' : got == fit ? 'b' : '?';
+    kufree(got);
+    kufree(pinA);
+    kufree(pinB);
+    return which;
+}
+
+int main(void) {
+    CHECK(pick(KU_POLICY_BEST) == 'b');
+    CHECK(pick(KU_POLICY_WORST) == 'w');
+    CHECK(kumalloc_set_policy((KuPolicy)(KU_POLICY_ADAPTIVE + 1)) == -1);
+    CHECK(kumalloc_set_policy((KuPolicy)-1) == -1);
+
+    // a long own-bin list of blocks that are all too small must not be
+    // walked to the end, the search stops and takes a higher bin or grows
+    CHECK(kumalloc_set_policy(KU_POLICY_HYBRID) == 0);
+    for (int i = 0; i < PINNED; ++i) {
+        small[i] = kumalloc(1040);
+        pins[i] = kumalloc(1040);
+    }
+    for (int i = 0; i < PINNED; ++i) {
+        kufree(small[i]);
+    }
+    void* big = kumalloc(2000);
+    CHECK(big != NULL);
+    KuMallocStats stats;
+    kumalloc_stats(&stats);
+    CHECK(stats.longestScan <= 64 + 2);
+    kufree(big);
+    for (int i = 0; i < PINNED; ++i) {
+        kufree(pins[i]);
+    }
+
+    // every policy keeps blocks intact under churn, switching mid-run
+    unsigned state = 11;
+    for (int policy = KU_POLICY_HYBRID; policy <= KU_POLICY_ADAPTIVE; ++policy) {
+        CHECK(kumalloc_set_policy((KuPolicy)policy) == 0);
+        for (int op = 0; op < 40000; ++op) {
+            size_t slot = check_rand(&state) % LIVE;
+            if (live[slot] != NULL) {
+                for (size_t i = 0; i < liveSize[slot]; i += 31) {
+                    CHECK(live[slot][i] == (unsigned char)slot);
+                }
+                kufree(live[slot]);
+            }
+            liveSize[slot] = 1 + check_rand(&state) % 5000;
+            live[slot] = kumalloc(liveSize[slot]);
+            CHECK(live[slot] != NULL);
+            memset(live[slot], (int)slot, liveSize[slot]);
+        }
+    }
+    for (int slot = 0; slot < LIVE; ++slot) {
+        kufree(live[slot]);
+    }
+    return 0;
+}
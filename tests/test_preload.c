@@ -0,0 +1,101 @@
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+static void* churn(void* arg) {
+    char* blocks[256];
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < 256; ++i) {
+            blocks[i] = malloc(1 + (i * 37 + round) % 3000);
+            CHECK(blocks[i] != NULL);
+            blocks[i][0] = (char)i;
+        }
+        for (int i = 0; i < 256; ++i) {
+            CHECK(blocks[i][0] == (char)i);
+            free(blocks[i]);
+        }
+    }
+    return arg;
+}
+
+// runs with libkumalloc.so preloaded, the C library entry points are ours
+static int preloaded(void) {
+    void (*stats)(KuMallocStats*) = (void (*)(KuMallocStats*))dlsym(RTLD_DEFAULT, "kumalloc_stats");
+    CHECK(stats != NULL);
+    KuMallocStats before, after;
+    stats(&before);
+
+    // unlike kumalloc, malloc(0) is a unique pointer
+    void* zero = malloc(0);
+    void* zero2 = malloc(0);
+    CHECK(zero != NULL && zero2 != NULL && zero != zero2);
+    free(zero);
+    free(zero2);
+
+    char* text = strdup("kumalloc behind the C library");
+    CHECK(text != NULL);
+    text = realloc(text, 4000);
+    CHECK(text != NULL && strcmp(text, "kumalloc behind the C library") == 0);
+    CHECK(malloc_usable_size(text) >= 4000);
+    free(text);
+
+    int* numbers = calloc(1000, sizeof(int));
+    CHECK(numbers != NULL);
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(numbers[i] == 0);
+    }
+    free(numbers);
+
+    void* aligned;
+    CHECK(posix_memalign(&aligned, 4096, 100) == 0);
+    CHECK(((uintptr_t)aligned & 4095) == 0);
+    free(aligned);
+    CHECK(posix_memalign(&aligned, 24, 100) == EINVAL);
+    aligned = aligned_alloc(64, 640);
+    CHECK(aligned != NULL && ((uintptr_t)aligned & 63) == 0);
+    free(aligned);
+    aligned = memalign(256, 10);
+    CHECK(aligned != NULL && ((uintptr_t)aligned & 255) == 0);
+    free(aligned);
+
+    pthread_t threads[4];
+    for (int t = 0; t < 4; ++t) {
+        CHECK(pthread_create(&threads[t], NULL, churn, NULL) == 0);
+    }
+    for (int t = 0; t < 4; ++t) {
+        CHECK(pthread_join(threads[t], NULL) == 0);
+    }
+
+    stats(&after);
+    size_t calls = 0;
+    for (int i = 0; i < KU_STATS_CLASSES; ++i) {
+        calls += after.allocs[i] - before.allocs[i];
+    }
+    CHECK(calls >= 4 * 100 * 256);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "preloaded") == 0) {
+        return preloaded();
+    }
+
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        setenv("LD_PRELOAD", "./build/libkumalloc.so", 1);
+        execl(argv[0], argv[0], "preloaded", (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return 0;
+}
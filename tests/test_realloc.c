@@ -0,0 +1,71 @@
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+static void fill(char* p, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        p[i] = (char)(i * 7);
+    }
+}
+
+static int intact(const char* p, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (p[i] != (char)(i * 7)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(void) {
+    // growing into a free successor keeps the address
+    char* a = kumalloc(1000);
+    char* b = kumalloc(1000);
+    char* guard = kumalloc(1000);
+    CHECK(a != NULL && b != NULL && guard != NULL);
+    fill(a, 1000);
+    kufree(b);
+    CHECK(kurealloc(a, 1800) == a);
+    CHECK(intact(a, 1000));
+
+    // shrinking keeps the address and the tail is usable again
+    fill(a, 1800);
+    CHECK(kurealloc(a, 600) == a);
+    CHECK(intact(a, 600));
+    b = kumalloc(1000);
+    CHECK(b > a && b < guard);
+    kufree(b);
+    kufree(guard);
+
+    // the last block of the heap grows by moving the break
+    char* top = kumalloc(2000);
+    CHECK(top != NULL);
+    fill(top, 2000);
+    CHECK(kurealloc(top, 60000) == top);
+    CHECK(intact(top, 2000));
+
+    // growing one byte at a time never loses data
+    char* buf = kumalloc(1);
+    size_t size;
+    for (size = 1; size <= 300000; size += size / 8 + 1) {
+        buf = kurealloc(buf, size);
+        CHECK(buf != NULL);
+        fill(buf, size);
+    }
+    CHECK(intact(buf, size - size / 8 - 1));
+
+    // mapped blocks resize through mremap and keep their contents
+    char* mapped = kumalloc(1 << 20);
+    CHECK(mapped != NULL);
+    fill(mapped, 1 << 20);
+    mapped = kurealloc(mapped, 4 << 20);
+    CHECK(mapped != NULL && intact(mapped, 1 << 20));
+    mapped = kurealloc(mapped, 256 * 1024);
+    CHECK(mapped != NULL && intact(mapped, 256 * 1024));
+
+    CHECK(kurealloc(mapped, 0) == NULL);
+    kufree(buf);
+    kufree(top);
+    kufree(a);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define OBJECTS 5000
+
+static unsigned char* objects[OBJECTS];
+static size_t sizes[OBJECTS];
+
+// fills the region past several chunks, every object keeps its own bytes
+static void fill(KuArena* arena, unsigned seed) {
+    for (int i = 0; i < OBJECTS; ++i) {
+        sizes[i] = 1 + check_rand(&seed) % 300;
+        objects[i] = kuarena_alloc(arena, sizes[i]);
+        CHECK(objects[i] != NULL);
+        CHECK(((uintptr_t)objects[i] & 15) == 0);
+        memset(objects[i], i & 0xff, sizes[i]);
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        for (size_t j = 0; j < sizes[i]; ++j) {
+            CHECK(objects[i][j] == (unsigned char)(i & 0xff));
+        }
+    }
+}
+
+int main(void) {
+    KuArena* arena = kuarena_create(0);
+    CHECK(arena != NULL);
+    void* first = kuarena_alloc(arena, 16);
+    CHECK(first != NULL);
+
+    // rewinding drops what came after the mark, across chunk boundaries
+    KuArenaMark mark = kuarena_mark(arena);
+    void* next = kuarena_alloc(arena, 100);
+    fill(arena, 1);
+    kuarena_rewind(arena, mark);
+    CHECK(kuarena_alloc(arena, 100) == next);
+
+    // a reset keeps the first chunk and starts over at its beginning
+    fill(arena, 2);
+    kuarena_reset(arena);
+    CHECK(kuarena_alloc(arena, 16) == first);
+
+    // larger than a chunk gets a chunk of its own
+    unsigned char* big = kuarena_alloc(arena, 1 << 20);
+    CHECK(big != NULL);
+    memset(big, 0x99, 1 << 20);
+
+    // size 0 and sizes that would wrap when rounded up fail, without
+    // handing out the current top
+    CHECK(kuarena_alloc(arena, 0) == NULL);
+    CHECK(kuarena_alloc(arena, SIZE_MAX) == NULL);
+    CHECK(kuarena_alloc(arena, SIZE_MAX - 8) == NULL);
+    void* a = kuarena_alloc(arena, 1);
+    void* b = kuarena_alloc(arena, 1);
+    CHECK(a != NULL && b != NULL && a != b);
+
+    kuarena_destroy(arena);
+    return 0;
+}
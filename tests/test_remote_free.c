@@ -0,0 +1,47 @@
+#include <pthread.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define N 10000
+
+static void* blocks[N];
+
+static void* consumer(void* arg) {
+    (void)arg;
+    for (int i = 0; i < N; ++i) {
+        kufree(blocks[i]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    // warm the main thread's cache so the counts below only move with the
+    // blocks handed to the other thread
+    kufree(kumalloc(100));
+    kufree(kumalloc(1000));
+
+    KuMallocStats before, after;
+    kumalloc_stats(&before);
+    for (int i = 0; i < N; ++i) {
+        size_t size = i % 2 ? 1000 : 100;
+        blocks[i] = kumalloc(size);
+        CHECK(blocks[i] != NULL);
+        memset(blocks[i], i, size);
+    }
+
+    // the second thread runs on another arena, every free is remote: the
+    // large ones are pushed one by one, the small ones as chains when its
+    // cache drains at exit
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, consumer, NULL) == 0);
+    CHECK(pthread_join(thread, NULL) == 0);
+
+    // the owner takes its list back on its next allocation
+    kufree(kumalloc(5000));
+    kumalloc_stats(&after);
+    CHECK(after.remoteFrees - before.remoteFrees == N);
+    // every block came back, the main thread's cache may even hold less now
+    CHECK(after.bytesInUse <= before.bytesInUse);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.h"
+
+#define TRACE_PREFIX "./build/test_replay"
+#define OUTPUT_MAX (1 << 20)
+
+// runs under libkutrace.so, every call below lands in the trace
+static int record(void) {
+    static void* blocks[1024];
+    unsigned seed = 99;
+    for (int round = 0; round < 50000; ++round) {
+        int i = check_rand(&seed) % 1024;
+        size_t size = 1 + check_rand(&seed) % (round % 16 ? 600 : 200000);
+        if (blocks[i] != NULL && round % 3 == 0) {
+            blocks[i] = realloc(blocks[i], size);
+        } else if (blocks[i] != NULL) {
+            free(blocks[i]);
+            blocks[i] = NULL;
+            continue;
+        } else if (round % 7 == 0) {
+            CHECK(posix_memalign(&blocks[i], 64, size) == 0);
+        } else if (round % 7 == 1) {
+            blocks[i] = memalign(4096, size);
+        } else if (round % 7 == 2) {
+            blocks[i] = aligned_alloc(32, (size + 31) & ~(size_t)31);
+        } else if (round % 7 == 3) {
+            blocks[i] = calloc(1, size);
+        } else {
+            blocks[i] = malloc(size);
+        }
+        CHECK(blocks[i] != NULL);
+    }
+    for (int i = 0; i < 1024; i += 2) {
+        free(blocks[i]);
+    }
+    return 0;
+}
+
+// blank the value of key, it depends on timing rather than on the trace
+static void drop_field(char* output, const char* key) {
+    for (char* at = strstr(output, key); at != NULL; at = strstr(at + 1, key)) {
+        for (char* p = at + strlen(key); *p != ',' && *p != '}' && *p != '\0'; ++p) {
+            *p = '_';
+        }
+    }
+}
+
+static void replay(const char* trace, char* output) {
+    char command[256];
+    snprintf(command, sizeof(command), "./build/kureplay %s 500", trace);
+    FILE* pipe = popen(command, "r");
+    CHECK(pipe != NULL);
+    size_t length = fread(output, 1, OUTPUT_MAX - 1, pipe);
+    output[length] = '\0';
+    CHECK(pclose(pipe) == 0);
+    drop_field(output, "\"replay_ms\":");
+    drop_field(output, "\"ns_per_record\":");
+    drop_field(output, "\"peak_rss_kb\":");
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "record") == 0) {
+        return record();
+    }
+
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        setenv("LD_PRELOAD", "./build/libkutrace.so", 1);
+        setenv("KUTRACE_FILE", TRACE_PREFIX, 1);
+        execl(argv[0], argv[0], "record", (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    char trace[64];
+    snprintf(trace, sizeof(trace), TRACE_PREFIX ".%d.bin", (int)child);
+    static char first[OUTPUT_MAX], second[OUTPUT_MAX];
+    replay(trace, first);
+    replay(trace, second);
+    unlink(trace);
+
+    // every free, aligned blocks included, finds the block it frees, and
+    // two replays of one trace drive the heap through the same states
+    CHECK(strstr(first, "\"unmatched\":0}") != NULL);
+    CHECK(strstr(first, "\"records\":0,") == NULL);
+    CHECK(strcmp(first, second) == 0);
+    return 0;
+}
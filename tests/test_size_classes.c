@@ -0,0 +1,73 @@
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define SLOTS 512
+#define ROUNDS 50000
+
+static unsigned char* slots[SLOTS];
+static size_t sizes[SLOTS];
+
+static void fill(int i) {
+    memset(slots[i], i & 0xff, sizes[i]);
+}
+
+static int intact(int i) {
+    for (size_t j = 0; j < sizes[i]; ++j) {
+        if (slots[i][j] != (unsigned char)(i & 0xff)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(void) {
+    CHECK(kumalloc(0) == NULL);
+
+    // a freed small block is handed out again for the same size class, the
+    // first-fit range takes its exact bin before carving new memory
+    void* a = kumalloc(40);
+    void* b = kumalloc(40);
+    CHECK(a != NULL && b != NULL && a != b);
+    kufree(a);
+    void* c = kumalloc(40);
+    CHECK(c == a);
+    kufree(c);
+    kufree(b);
+
+    // a request that leaves only a header's worth of a fresh sbrk batch must
+    // keep the tail instead of binning an empty block
+    void* d = kumalloc(1000);
+    void* e = kumalloc(1000);
+    CHECK(d != NULL && e != NULL);
+    CHECK((char*)e + 1000 <= (char*)sbrk(0));
+    memset(d, 1, 1000);
+    memset(e, 2, 1000);
+    kufree(e);
+    kufree(d);
+
+    // random sizes across the exact and the power-of-two bins, no block may
+    // overlap another live one
+    unsigned seed = 12345;
+    for (int round = 0; round < ROUNDS; ++round) {
+        int i = check_rand(&seed) % SLOTS;
+        if (slots[i] != NULL) {
+            CHECK(intact(i));
+            kufree(slots[i]);
+            slots[i] = NULL;
+        } else {
+            sizes[i] = 1 + check_rand(&seed) % (round % 2 ? 480 : 8192);
+            slots[i] = kumalloc(sizes[i]);
+            CHECK(slots[i] != NULL);
+            fill(i);
+        }
+    }
+    for (int i = 0; i < SLOTS; ++i) {
+        if (slots[i] != NULL) {
+            CHECK(intact(i));
+            kufree(slots[i]);
+        }
+    }
+    return 0;
+}
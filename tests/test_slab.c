@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define OBJECTS 20000
+
+static void* objects[OBJECTS];
+
+static void use(KuSlab* slab, size_t objSize, size_t align) {
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = kuslab_alloc(slab);
+        CHECK(objects[i] != NULL);
+        CHECK(((uintptr_t)objects[i] & (align - 1)) == 0);
+        memset(objects[i], i & 0xff, objSize);
+    }
+    // free every other object, their slots come back before new ones
+    for (int i = 0; i < OBJECTS; i += 2) {
+        kuslab_free(slab, objects[i]);
+    }
+    for (int i = 0; i < OBJECTS; i += 2) {
+        void* again = kuslab_alloc(slab);
+        CHECK(again != NULL);
+        memset(again, i & 0xff, objSize);
+        objects[i] = again;
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        const unsigned char* p = objects[i];
+        for (size_t j = 0; j < objSize; ++j) {
+            CHECK(p[j] == (unsigned char)(i & 0xff));
+        }
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        kuslab_free(slab, objects[i]);
+    }
+}
+
+int main(void) {
+    KuSlab* small = kuslab_create(24, 8);
+    KuSlab* odd = kuslab_create(100, 64);
+    KuSlab* large = kuslab_create(3000, 16);
+    CHECK(small != NULL && odd != NULL && large != NULL);
+    use(small, 24, 8);
+    use(odd, 100, 64);
+    use(large, 3000, 16);
+
+    // the last freed slot is the next one handed out
+    void* p = kuslab_alloc(small);
+    kuslab_free(small, p);
+    CHECK(kuslab_alloc(small) == p);
+
+    kuslab_destroy(small);
+    kuslab_destroy(odd);
+    kuslab_destroy(large);
+
+    CHECK(kuslab_create(0, 8) == NULL);
+    CHECK(kuslab_create(32, 24) == NULL);
+    CHECK(kuslab_create(32, 1 << 20) == NULL);
+    // slab sizes for these would wrap, they must fail rather than hang
+    CHECK(kuslab_create((size_t)1 << 61, 8) == NULL);
+    CHECK(kuslab_create(SIZE_MAX / 2, 8) == NULL);
+    CHECK(kuslab_create(SIZE_MAX, 4096) == NULL);
+
+    // a big but representable size is set up, its slabs just fail to map
+    KuSlab* huge = kuslab_create((size_t)1 << 50, 8);
+    CHECK(huge != NULL);
+    CHECK(kuslab_alloc(huge) == NULL);
+    kuslab_destroy(huge);
+    return 0;
+}
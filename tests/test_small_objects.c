@@ -0,0 +1,121 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define LIVE 4096
+
+static size_t total(const size_t* counts) {
+    size_t sum = 0;
+    for (int i = 0; i < KU_STATS_CLASSES; ++i) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+static pthread_key_t lateKey;
+
+static void late_destructor(void* value) {
+    kufree(value);
+    kufree(kumalloc(24));
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+    void* objects[200];
+    for (int i = 0; i < 200; ++i) {
+        objects[i] = kumalloc(1 + i % 128);
+    }
+    for (int i = 0; i < 200; ++i) {
+        kufree(objects[i]);
+    }
+    pthread_setspecific(lateKey, kumalloc(40));
+    return NULL;
+}
+
+int main(void) {
+    KuMallocStats before, after;
+    kumalloc_stats(&before);
+
+    // every size up to the limit is served headerless from its 16-byte class
+    void* bySize[129];
+    for (size_t size = 1; size <= 128; ++size) {
+        bySize[size] = kumalloc(size);
+        CHECK(bySize[size] != NULL);
+        CHECK((uintptr_t)bySize[size] % 16 == 0);
+        CHECK(kumalloc_usable_size(bySize[size]) == ((size + 15) & ~(size_t)15));
+        memset(bySize[size], (int)size, size);
+    }
+    kumalloc_stats(&after);
+    CHECK(after.smallBytes > 0);
+    for (size_t size = 1; size <= 128; ++size) {
+        unsigned char* p = bySize[size];
+        for (size_t i = 0; i < size; ++i) {
+            CHECK(p[i] == (unsigned char)size);
+        }
+        kufree(p);
+    }
+
+    // realloc moves between headerless objects and headed blocks
+    unsigned char* p = kumalloc(100);
+    for (int i = 0; i < 100; ++i) {
+        p[i] = (unsigned char)i;
+    }
+    p = kurealloc(p, 2000);
+    CHECK(p != NULL && kumalloc_usable_size(p) >= 2000);
+    for (int i = 0; i < 100; ++i) {
+        CHECK(p[i] == (unsigned char)i);
+    }
+    p = kurealloc(p, 40);
+    CHECK(p != NULL && kumalloc_usable_size(p) == 48);
+    for (int i = 0; i < 40; ++i) {
+        CHECK(p[i] == (unsigned char)i);
+    }
+    kufree(p);
+
+    unsigned char* zeroed = kucalloc(7, 16);
+    CHECK(zeroed != NULL);
+    for (int i = 0; i < 7 * 16; ++i) {
+        CHECK(zeroed[i] == 0);
+    }
+    kufree(zeroed);
+
+    // random churn over small and headed sizes, every object keeps its bytes
+    static unsigned char* live[LIVE];
+    static size_t liveSize[LIVE];
+    unsigned state = 7;
+    for (int op = 0; op < 200000; ++op) {
+        size_t slot = check_rand(&state) % LIVE;
+        if (live[slot] != NULL) {
+            for (size_t i = 0; i < liveSize[slot]; ++i) {
+                CHECK(live[slot][i] == (unsigned char)slot);
+            }
+            kufree(live[slot]);
+        }
+        liveSize[slot] = check_rand(&state) % 8 == 0 ? 129 + check_rand(&state) % 800
+                                                      : 1 + check_rand(&state) % 128;
+        live[slot] = kumalloc(liveSize[slot]);
+        CHECK(live[slot] != NULL);
+        memset(live[slot], (int)slot, liveSize[slot]);
+    }
+    for (size_t slot = 0; slot < LIVE; ++slot) {
+        kufree(live[slot]);
+    }
+
+    // exiting threads hand their headerless lists back, including what a
+    // TLS destructor frees after the exit flush. The main thread's cache
+    // keeps what the churn above left in it, so measure from here
+    kumalloc_stats(&before);
+    CHECK(pthread_key_create(&lateKey, late_destructor) == 0);
+    for (int t = 0; t < 50; ++t) {
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, worker, NULL) == 0);
+        CHECK(pthread_join(thread, NULL) == 0);
+    }
+    kumalloc_stats(&after);
+    // mapped runs count as in use whether or not their objects are live
+    CHECK(after.bytesInUse - after.smallBytes == before.bytesInUse - before.smallBytes);
+    CHECK(total(after.allocs) - total(before.allocs) == total(after.frees) - total(before.frees));
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <pthread.h>
+#include "alloc.h"
+#include "check.h"
+
+static size_t total(const size_t* counts) {
+    size_t sum = 0;
+    for (int i = 0; i < KU_STATS_CLASSES; ++i) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+static pthread_key_t lateKey;
+
+static void late_destructor(void* value) {
+    kufree(value);
+    kufree(kumalloc(64));
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+    void* blocks[100];
+    for (int i = 0; i < 100; ++i) {
+        blocks[i] = kumalloc(8 + 40 * i);
+    }
+    for (int i = 0; i < 100; ++i) {
+        kufree(blocks[i]);
+    }
+    pthread_setspecific(lateKey, kumalloc(200));
+    return NULL;
+}
+
+int main(void) {
+    KuMallocStats before, during, after;
+    kumalloc_stats(&before);
+
+    void* block = kumalloc(1000);
+    void* mapped = kumalloc(1 << 20);
+    CHECK(block != NULL && mapped != NULL);
+    kumalloc_stats(&during);
+    CHECK(total(during.allocs) == total(before.allocs) + 2);
+    CHECK(during.bytesInUse >= before.bytesInUse + 1000 + (1 << 20));
+    CHECK(during.mmapCalls == before.mmapCalls + 1);
+    CHECK(during.mmapBytes >= before.mmapBytes + (1 << 20));
+    CHECK(during.heapBytes >= during.bytesFree);
+    CHECK(during.largestFree <= during.bytesFree);
+    CHECK(during.fragmentation >= 0.0 && during.fragmentation <= 1.0);
+
+    kufree(mapped);
+    kufree(block);
+    kumalloc_stats(&after);
+    CHECK(total(after.frees) == total(before.frees) + 2);
+    CHECK(after.bytesInUse == before.bytesInUse);
+    CHECK(after.mmapBytes == before.mmapBytes);
+
+    // threads hand back everything they cached, including what a TLS
+    // destructor frees after the allocator's own exit flush
+    CHECK(pthread_key_create(&lateKey, late_destructor) == 0);
+    for (int t = 0; t < 50; ++t) {
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, worker, NULL) == 0);
+        CHECK(pthread_join(thread, NULL) == 0);
+    }
+    kumalloc_stats(&after);
+    CHECK(after.bytesInUse == before.bytesInUse);
+    CHECK(total(after.allocs) - total(before.allocs) == total(after.frees) - total(before.frees));
+    return 0;
+}
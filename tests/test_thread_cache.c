@@ -0,0 +1,60 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define THREADS 500
+#define BLOCKS 64
+
+static pthread_key_t lateKey;
+
+// runs after the allocator's exit flush, whatever it frees must still reach
+// an arena instead of a cache nobody will flush again
+static void late_destructor(void* value) {
+    kufree(value);
+    for (int i = 0; i < BLOCKS; ++i) {
+        kufree(kumalloc(48));
+    }
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+    void* blocks[BLOCKS];
+    for (int i = 0; i < BLOCKS; ++i) {
+        blocks[i] = kumalloc(16 + 16 * (i % 8));
+        CHECK(blocks[i] != NULL);
+    }
+    for (int i = 0; i < BLOCKS; ++i) {
+        kufree(blocks[i]);
+    }
+    pthread_setspecific(lateKey, kumalloc(100));
+    return NULL;
+}
+
+int main(void) {
+    // a small block comes straight back from the cache it was freed into
+    void* p = kumalloc(48);
+    kufree(p);
+    CHECK(kumalloc(48) == p);
+    kufree(p);
+
+    // created after the allocator's key, so its destructor runs later
+    CHECK(pthread_key_create(&lateKey, late_destructor) == 0);
+
+    // warm up every arena once, then many short-lived threads must not
+    // grow the heap
+    for (int t = 0; t < 16; ++t) {
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, worker, NULL) == 0);
+        CHECK(pthread_join(thread, NULL) == 0);
+    }
+    char* before = sbrk(0);
+    for (int t = 0; t < THREADS; ++t) {
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, worker, NULL) == 0);
+        CHECK(pthread_join(thread, NULL) == 0);
+    }
+    CHECK((char*)sbrk(0) - before < 64 * 1024);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <pthread.h>
+#include <string.h>
+#include "alloc.h"
+#include "check.h"
+
+#define THREADS 8
+#define SLOTS 256
+#define ROUNDS 20000
+
+typedef struct Worker {
+    pthread_t thread;
+    unsigned seed;
+    unsigned char* slots[SLOTS];
+    size_t sizes[SLOTS];
+} Worker;
+
+static Worker workers[THREADS];
+
+static int intact(const unsigned char* p, size_t size, unsigned char tag) {
+    for (size_t j = 0; j < size; ++j) {
+        if (p[j] != tag) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* work(void* arg) {
+    Worker* w = arg;
+    unsigned char tag = (unsigned char)(w - workers);
+    for (int round = 0; round < ROUNDS; ++round) {
+        int i = check_rand(&w->seed) % SLOTS;
+        if (w->slots[i] != NULL) {
+            CHECK(intact(w->slots[i], w->sizes[i], tag));
+            kufree(w->slots[i]);
+            w->slots[i] = NULL;
+        } else {
+            w->sizes[i] = 1 + check_rand(&w->seed) % 2048;
+            w->slots[i] = kumalloc(w->sizes[i]);
+            CHECK(w->slots[i] != NULL);
+            memset(w->slots[i], tag, w->sizes[i]);
+        }
+    }
+    return NULL;
+}
+
+int main(void) {
+    for (int t = 0; t < THREADS; ++t) {
+        workers[t].seed = 1000 + t;
+        CHECK(pthread_create(&workers[t].thread, NULL, work, &workers[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; ++t) {
+        CHECK(pthread_join(workers[t].thread, NULL) == 0);
+    }
+
+    // whatever the workers left behind is freed here, back into the arenas
+    // that carved it, and the memory must be usable again
+    for (int t = 0; t < THREADS; ++t) {
+        for (int i = 0; i < SLOTS; ++i) {
+            if (workers[t].slots[i] != NULL) {
+                CHECK(intact(workers[t].slots[i], workers[t].sizes[i], (unsigned char)t));
+                kufree(workers[t].slots[i]);
+            }
+        }
+    }
+    for (int i = 0; i < 1000; ++i) {
+        void* p = kumalloc(1 + i);
+        CHECK(p != NULL);
+        memset(p, 0xee, 1 + i);
+        kufree(p);
+    }
+    return 0;
+}
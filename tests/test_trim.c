@@ -0,0 +1,58 @@
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define SPANS 64
+#define SPAN 64000
+
+int main(void) {
+    KuScavengeStats before, after;
+    kumalloc_set_scavenge_interval(0);  // only the explicit trim below
+    kumalloc_scavenge_stats(&before);
+
+    // an idle span under a live block can only be released, not trimmed
+    char* hole = kumalloc(100000);
+    char* pin = kumalloc(1000);
+    CHECK(hole != NULL && pin != NULL);
+    memset(pin, 0x77, 1000);
+    kufree(hole);
+
+    // free spans at the top of the heap shrink the program break
+    char* spans[SPANS];
+    for (int i = 0; i < SPANS; ++i) {
+        spans[i] = kumalloc(SPAN);
+        CHECK(spans[i] != NULL);
+        memset(spans[i], i, SPAN);
+    }
+    char* top = sbrk(0);
+    for (int i = 0; i < SPANS; ++i) {
+        kufree(spans[i]);
+    }
+    CHECK(kumalloc_trim(0) > 0);
+    CHECK((char*)sbrk(0) < top);
+
+    kumalloc_scavenge_stats(&after);
+    CHECK(after.passes > before.passes);
+    CHECK(after.trimmedBytes > before.trimmedBytes);
+    CHECK(after.releasedBytes > before.releasedBytes);
+
+    // released and trimmed memory is handed out again as usual
+    for (size_t i = 0; i < 1000; ++i) {
+        CHECK(pin[i] == 0x77);
+    }
+    hole = kumalloc(100000);
+    CHECK(hole != NULL);
+    memset(hole, 0x12, 100000);
+    for (int i = 0; i < SPANS; ++i) {
+        spans[i] = kumalloc(SPAN);
+        CHECK(spans[i] != NULL);
+        memset(spans[i], i, SPAN);
+    }
+    for (int i = 0; i < SPANS; ++i) {
+        kufree(spans[i]);
+    }
+    kufree(hole);
+    kufree(pin);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <string.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "check.h"
+
+#define COUNT 10000
+
+static void* blocks[COUNT];
+
+int main(void) {
+    KuMallocStats before, after;
+    kumalloc_set_mmap_threshold((size_t)64 << 20);
+
+    // a buffer at the top grows in place through the heap extensions
+    char* keep = kumalloc(600);
+    char* buf = kumalloc(600);
+    CHECK(keep != NULL && buf != NULL);
+    char* first = buf;
+    kumalloc_stats(&before);
+    for (size_t size = 608; size <= (1 << 20); size += 8) {
+        buf = kurealloc(buf, size);
+        CHECK(buf != NULL);
+        buf[size - 1] = (char)size;
+        CHECK(size == 608 || buf[size - 9] == (char)(size - 8));
+    }
+    kumalloc_stats(&after);
+    CHECK(buf == first);
+    CHECK(after.sbrkCalls - before.sbrkCalls < 20);
+    kufree(buf);
+    kufree(keep);
+
+    // the growth step doubles, so a long run of allocations needs a few
+    // extensions instead of one per page or so
+    kumalloc_stats(&before);
+    for (int i = 0; i < COUNT; ++i) {
+        blocks[i] = kumalloc(1000);
+        CHECK(blocks[i] != NULL);
+        memset(blocks[i], i, 1000);
+    }
+    kumalloc_stats(&after);
+    CHECK(after.sbrkCalls - before.sbrkCalls <= 16);
+    CHECK(after.heapBytes < (size_t)COUNT * 1024 * 2);
+    for (int i = 0; i < COUNT; ++i) {
+        kufree(blocks[i]);
+    }
+    return 0;
+}
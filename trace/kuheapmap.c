@@ -0,0 +1,104 @@
+/*
+ * Heap map writer, linked into the program whose heap is being mapped:
+ *
+ *   int fd = open("heap.map", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+ *   kuheapmap_begin(fd);
+ *   ...
+ *   kuheapmap_snapshot(fd, step);
+ *
+ * The walk callback runs under the allocator's locks, so records go through
+ * a buffer on the stack and out with write(2), never through stdio or
+ * anything else that might allocate.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "kuheapmap.h"
+
+#define MAP_BUFFER 512
+
+typedef struct {
+    int fd;
+    int failed;
+    uint64_t next;  // address the previous block ended at
+    size_t buffered;
+    KuHeapMapRecord buffer[MAP_BUFFER];
+} MapWriter;
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t written = write(fd, ptr, len);
+        if (written <= 0) {
+            return -1;
+        }
+        ptr += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static void map_flush(MapWriter *writer) {
+    if (writer->buffered > 0 && !writer->failed) {
+        writer->failed = write_all(writer->fd, writer->buffer, writer->buffered * sizeof(KuHeapMapRecord));
+    }
+    writer->buffered = 0;
+}
+
+static void map_put(MapWriter *writer, uint32_t units, uint16_t objects, uint8_t state, uint8_t arena) {
+    if (writer->buffered == MAP_BUFFER) {
+        map_flush(writer);
+    }
+    KuHeapMapRecord *rec = &writer->buffer[writer->buffered++];
+    rec->units = units;
+    rec->objects = objects;
+    rec->state = state;
+    rec->arena = arena;
+}
+
+static int map_block(const KuHeapBlock *block, void *arg) {
+    MapWriter *writer = arg;
+    uint64_t address = (uintptr_t)block->address;
+    if (address != writer->next) {
+        uint64_t units = address / KUHEAPMAP_UNIT;
+        map_put(writer, (uint32_t)units, (uint16_t)(units >> 32), KUHEAPMAP_SEEK, 0);
+    }
+    uint8_t arena = block->arena < 0 ? 0 : (uint8_t)(block->arena + 1);
+    uint16_t objects = block->objects > UINT16_MAX ? UINT16_MAX : (uint16_t)block->objects;
+    uint64_t units = block->size / KUHEAPMAP_UNIT;
+    do {
+        uint32_t part = units > UINT32_MAX ? UINT32_MAX : (uint32_t)units;
+        map_put(writer, part, objects, (uint8_t)block->state, arena);
+        units -= part;
+    } while (units > 0);
+    writer->next = address + block->size;
+    return 0;
+}
+
+int kuheapmap_begin(int fd) {
+    KuHeapMapHeader header;
+    memcpy(header.magic, KUHEAPMAP_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(KuHeapMapRecord);
+    header.pid = (uint32_t)getpid();
+    return write_all(fd, &header, sizeof(header));
+}
+
+int kuheapmap_snapshot(int fd, uint64_t tag) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    KuHeapMapSnapshot snapshot = {tag, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec};
+    if (write_all(fd, &snapshot, sizeof(snapshot)) != 0) {
+        return -1;
+    }
+    MapWriter writer;
+    writer.fd = fd;
+    writer.failed = 0;
+    writer.next = 0;
+    writer.buffered = 0;
+    kuheap_walk(map_block, &writer);
+    map_put(&writer, 0, 0, KUHEAPMAP_END, 0);
+    map_flush(&writer);
+    return writer.failed ? -1 : 0;
+}
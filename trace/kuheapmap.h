@@ -0,0 +1,55 @@
+#ifndef KUHEAPMAP_H
+#define KUHEAPMAP_H
+
+#include <stdint.h>
+
+/*
+ * Binary heap map written by kuheapmap_snapshot and read by kuheatmap.
+ *
+ * A file is one KuHeapMapHeader followed by snapshots. A snapshot is a
+ * KuHeapMapSnapshot and then one record per block as kuheap_walk reported
+ * it, closed by a KUHEAPMAP_END record. Blocks of a region follow each other
+ * in memory, so a record only carries the size; a KUHEAPMAP_SEEK record
+ * sets the address of the next block whenever it does not start where the
+ * last one ended. Eight bytes per block keep a snapshot of a busy heap small
+ * enough to take every few thousand calls.
+ */
+
+#define KUHEAPMAP_MAGIC "KUHEAPM1"
+#define KUHEAPMAP_UNIT 16  // sizes and addresses are counted in these
+
+enum {
+    // 0 to 6 are the KuHeapState values of alloc.h
+    KUHEAPMAP_SEEK = 14,
+    KUHEAPMAP_END = 15,
+};
+
+typedef struct KuHeapMapHeader {
+    char magic[8];
+    uint32_t recordSize;  // sizeof(KuHeapMapRecord) of the writer
+    uint32_t pid;
+} KuHeapMapHeader;
+
+typedef struct KuHeapMapSnapshot {
+    uint64_t tag;  // chosen by the caller, kureplay uses the record number
+    uint64_t ns;   // CLOCK_MONOTONIC when the walk started
+} KuHeapMapSnapshot;
+
+typedef struct KuHeapMapRecord {
+    uint32_t units;    // block size in units, larger blocks take several records
+    uint16_t objects;  // objects in use of a slab or nursery chunk
+    uint8_t state;
+    uint8_t arena;     // owning arena plus one, 0 outside the arenas
+} KuHeapMapRecord;
+
+// a KUHEAPMAP_SEEK record holds the address in units, split over both fields
+#define KUHEAPMAP_SEEK_ADDRESS(rec) \
+    (((uint64_t)(rec)->objects << 32 | (rec)->units) * KUHEAPMAP_UNIT)
+
+// write the file header to fd, 0 on success and -1 on a write error
+int kuheapmap_begin(int fd);
+// walk the heap and append a snapshot to fd; allocates nothing, so it may
+// run at any point outside a kuheap_walk callback
+int kuheapmap_snapshot(int fd, uint64_t tag);
+
+#endif // KUHEAPMAP_H
@@ -0,0 +1,303 @@
+/*
+ * Renders a kuheapmap file as a fragmentation heatmap.
+ *
+ *   kuheatmap heap.map [heatmap.ppm] [width]
+ *
+ * Every snapshot becomes one row of the image, oldest at the top. A row lays
+ * the snapshot's blocks out in address order with the gaps between regions
+ * squeezed out, and all rows share one scale (the largest snapshot fills
+ * the width, default 1024 pixels), so growth shows as a longer row. A pixel
+ * mixes the colours of the bytes it covers: red in use, orange mapped,
+ * purple small-object slabs, pink nursery chunks, green free, blue the top
+ * chunks, grey free pages already given back.
+ *
+ * Output is JSON lines: one per snapshot with free bytes, the largest free
+ * block and the fragmentation of the arena blocks, then the pins: the
+ * in-use arena blocks of the last snapshot that border free memory, oldest
+ * first, with how many snapshots in a row they have sat at that address.
+ * Those are the blocks that keep the free space around them from merging.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kuheapmap.h"
+
+#define DEFAULT_WIDTH 1024
+#define PINS 10
+
+// KuHeapState values of alloc.h
+enum { IN_USE, FREE, TOP, RELEASED, MAPPED, SLAB, NURSERY, STATES };
+
+static const unsigned char colours[STATES][3] = {
+    [IN_USE] = {220, 50, 40},
+    [FREE] = {40, 170, 60},
+    [TOP] = {40, 90, 210},
+    [RELEASED] = {110, 110, 110},
+    [MAPPED] = {240, 160, 30},
+    [SLAB] = {150, 60, 190},
+    [NURSERY] = {230, 90, 150},
+};
+
+typedef struct {
+    uint64_t address;
+    uint64_t size;
+    uint8_t state;
+    uint8_t arena;
+} Block;
+
+typedef struct {
+    uint64_t tag;
+    uint64_t ns;
+    Block *blocks;
+    size_t count;
+    uint64_t bytes;
+} Snapshot;
+
+static void *checked_realloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "kuheatmap: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static int by_address(const void *a, const void *b) {
+    uint64_t left = ((const Block *)a)->address;
+    uint64_t right = ((const Block *)b)->address;
+    return (left > right) - (left < right);
+}
+
+static int is_free(uint8_t state) {
+    return state == FREE || state == TOP || state == RELEASED;
+}
+
+// read one snapshot, 0 at the end of the file
+static int read_snapshot(FILE *file, Snapshot *snapshot) {
+    KuHeapMapSnapshot head;
+    if (fread(&head, sizeof(head), 1, file) != 1) {
+        return 0;
+    }
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->tag = head.tag;
+    snapshot->ns = head.ns;
+    size_t capacity = 0;
+    uint64_t next = 0;
+    KuHeapMapRecord rec;
+    while (fread(&rec, sizeof(rec), 1, file) == 1) {
+        if (rec.state == KUHEAPMAP_END) {
+            break;
+        }
+        if (rec.state == KUHEAPMAP_SEEK) {
+            next = KUHEAPMAP_SEEK_ADDRESS(&rec);
+            continue;
+        }
+        if (rec.state >= STATES) {
+            continue;
+        }
+        if (snapshot->count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            snapshot->blocks = checked_realloc(snapshot->blocks, capacity * sizeof(Block));
+        }
+        Block *block = &snapshot->blocks[snapshot->count++];
+        block->address = next;
+        block->size = (uint64_t)rec.units * KUHEAPMAP_UNIT;
+        block->state = rec.state;
+        block->arena = rec.arena;
+        next += block->size;
+        snapshot->bytes += block->size;
+    }
+    qsort(snapshot->blocks, snapshot->count, sizeof(Block), by_address);
+    return 1;
+}
+
+static void print_summary(const Snapshot *snapshot, uint64_t firstNs) {
+    uint64_t inUse = 0;
+    uint64_t freeBytes = 0;
+    uint64_t largest = 0;
+    uint64_t mapped = 0;
+    size_t freeBlocks = 0;
+    for (size_t i = 0; i < snapshot->count; ++i) {
+        const Block *block = &snapshot->blocks[i];
+        if (is_free(block->state)) {
+            freeBytes += block->size;
+            freeBlocks++;
+            if (block->size > largest) {
+                largest = block->size;
+            }
+        } else if (block->state == IN_USE) {
+            inUse += block->size;
+        } else {
+            mapped += block->size;
+        }
+    }
+    printf("{\"tag\":%llu,\"ms\":%.3f,\"blocks\":%zu,\"in_use_bytes\":%llu,\"free_bytes\":%llu,"
+           "\"free_blocks\":%zu,\"largest_free\":%llu,\"outside_arena_bytes\":%llu,\"fragmentation\":%.4f}\n",
+           (unsigned long long)snapshot->tag, (snapshot->ns - firstNs) / 1e6, snapshot->count,
+           (unsigned long long)inUse, (unsigned long long)freeBytes, freeBlocks, (unsigned long long)largest,
+           (unsigned long long)mapped, freeBytes ? 1.0 - (double)largest / freeBytes : 0.0);
+}
+
+// one image row, bytes per pixel fixed across rows
+static void render_row(const Snapshot *snapshot, double bytesPerPixel, int width, unsigned char *row) {
+    memset(row, 0, (size_t)width * 3);
+    size_t i = 0;
+    uint64_t offset = 0;  // bytes of blocks before block i
+    for (int x = 0; x < width && i < snapshot->count; ++x) {
+        double start = x * bytesPerPixel;
+        double end = start + bytesPerPixel;
+        double mix[3] = {0, 0, 0};
+        while (i < snapshot->count) {
+            const Block *block = &snapshot->blocks[i];
+            double from = offset > start ? offset : start;
+            double to = offset + block->size < end ? offset + block->size : end;
+            if (to > from) {
+                for (int c = 0; c < 3; ++c) {
+                    mix[c] += colours[block->state][c] * (to - from);
+                }
+            }
+            if (offset + block->size > end) {
+                break;
+            }
+            offset += block->size;
+            ++i;
+        }
+        // the part of a pixel past the last block stays dark
+        for (int c = 0; c < 3; ++c) {
+            row[x * 3 + c] = (unsigned char)(mix[c] / bytesPerPixel + 0.5);
+        }
+    }
+}
+
+static int find_block(const Snapshot *snapshot, const Block *block) {
+    size_t low = 0;
+    size_t high = snapshot->count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (snapshot->blocks[mid].address < block->address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < snapshot->count && snapshot->blocks[low].address == block->address
+        && snapshot->blocks[low].size == block->size && snapshot->blocks[low].state == IN_USE;
+}
+
+typedef struct {
+    const Block *block;
+    size_t age;
+} Pin;
+
+// oldest first, then by address
+static int oldest_first(const void *a, const void *b) {
+    const Pin *left = a;
+    const Pin *right = b;
+    if (left->age != right->age) {
+        return left->age < right->age ? 1 : -1;
+    }
+    return (left->block->address > right->block->address) - (left->block->address < right->block->address);
+}
+
+static void print_pins(const Snapshot *snapshots, size_t count) {
+    const Snapshot *last = &snapshots[count - 1];
+    Pin *pins = checked_realloc(NULL, (last->count + 1) * sizeof(Pin));
+    size_t found = 0;
+    for (size_t i = 0; i < last->count; ++i) {
+        const Block *block = &last->blocks[i];
+        if (block->state != IN_USE) {
+            continue;
+        }
+        // only a physical neighbour counts, not the next region
+        int freeBefore = i > 0 && is_free(last->blocks[i - 1].state)
+            && last->blocks[i - 1].address + last->blocks[i - 1].size == block->address;
+        int freeAfter = i + 1 < last->count && is_free(last->blocks[i + 1].state)
+            && block->address + block->size == last->blocks[i + 1].address;
+        if (!freeBefore && !freeAfter) {
+            continue;
+        }
+        size_t age = 1;
+        while (age < count && find_block(&snapshots[count - 1 - age], block)) {
+            ++age;
+        }
+        pins[found].block = block;
+        pins[found].age = age;
+        ++found;
+    }
+    qsort(pins, found, sizeof(Pin), oldest_first);
+    for (size_t i = 0; i < found && i < PINS; ++i) {
+        printf("{\"pin\":\"0x%llx\",\"size\":%llu,\"arena\":%d,\"snapshots\":%zu,\"since_tag\":%llu}\n",
+               (unsigned long long)pins[i].block->address, (unsigned long long)pins[i].block->size,
+               pins[i].block->arena - 1, pins[i].age,
+               (unsigned long long)snapshots[count - pins[i].age].tag);
+    }
+    free(pins);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s heap.map [heatmap.ppm] [width]\n", argv[0]);
+        return 1;
+    }
+    int width = argc > 3 ? atoi(argv[3]) : DEFAULT_WIDTH;
+    if (width <= 0) {
+        width = DEFAULT_WIDTH;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    KuHeapMapHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, KUHEAPMAP_MAGIC, sizeof(header.magic)) != 0
+        || header.recordSize != sizeof(KuHeapMapRecord)) {
+        fprintf(stderr, "kuheatmap: %s is not a heap map\n", argv[1]);
+        return 1;
+    }
+    Snapshot *snapshots = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t largest = 0;
+    Snapshot snapshot;
+    while (read_snapshot(file, &snapshot)) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            snapshots = checked_realloc(snapshots, capacity * sizeof(Snapshot));
+        }
+        snapshots[count++] = snapshot;
+        if (snapshot.bytes > largest) {
+            largest = snapshot.bytes;
+        }
+    }
+    fclose(file);
+    if (count == 0) {
+        fprintf(stderr, "kuheatmap: %s holds no snapshots\n", argv[1]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        print_summary(&snapshots[i], snapshots[0].ns);
+    }
+    print_pins(snapshots, count);
+
+    if (argc > 2) {
+        FILE *image = fopen(argv[2], "wb");
+        if (image == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+        fprintf(image, "P6\n%d %zu\n255\n", width, count);
+        unsigned char *row = checked_realloc(NULL, (size_t)width * 3);
+        double bytesPerPixel = largest ? (double)largest / width : 1.0;
+        for (size_t i = 0; i < count; ++i) {
+            render_row(&snapshots[i], bytesPerPixel, width, row);
+            fwrite(row, 3, width, image);
+        }
+        free(row);
+        fclose(image);
+    }
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Replays a libkutrace.so trace into kumalloc as fast as possible.
+ *
+ *   kureplay kutrace.1234.bin [sample-every] [heap.map]
+ *
+ * Records are replayed on one thread in file order, which is the order the
+ * traced heap saw them, so the same trace always drives the same sequence of
+ * kumalloc calls and policy changes can be compared run against run. The
+ * decay scavenger is switched off, its passes depend on the wall clock and
+ * would make the heap layout vary with the replay speed. Thread IDs are only
+ * counted.
+ *
+ * Output is JSON lines: a sample every sample-every records (default 1024)
+ * with live bytes, heap and mapped bytes and fragmentation from
+ * kumalloc_stats, then a summary with the replay time (sampling excluded),
+ * the peak heap plus mapped footprint and the process peak RSS. Given a
+ * third argument it also writes a kuheapmap snapshot at every sample, for
+ * kuheatmap to render.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "kuheapmap.h"
+#include "kutrace.h"
+
+#define READ_BATCH 4096
+
+// traced address -> replayed address, open addressing with tombstones
+typedef struct {
+    uint64_t key;  // 0 empty, 1 deleted
+    void *ptr;
+    size_t size;
+} Slot;
+
+static Slot *slots;
+static size_t capacity;
+static size_t used;  // live entries plus tombstones
+
+static size_t slot_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (capacity - 1);
+}
+
+static Slot *map_find(uint64_t key) {
+    for (size_t i = slot_hash(key);; i = (i + 1) & (capacity - 1)) {
+        if (slots[i].key == key) {
+            return &slots[i];
+        }
+        if (slots[i].key == 0) {
+            return NULL;
+        }
+    }
+}
+
+static void map_insert(uint64_t key, void *ptr, size_t size);
+
+static void map_grow(void) {
+    Slot *old = slots;
+    size_t oldCapacity = capacity;
+    capacity = capacity ? capacity * 2 : 1 << 16;
+    slots = calloc(capacity, sizeof(Slot));
+    if (slots == NULL) {
+        fprintf(stderr, "kureplay: out of memory\n");
+        exit(1);
+    }
+    used = 0;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (old[i].key > 1) {
+            map_insert(old[i].key, old[i].ptr, old[i].size);
+        }
+    }
+    free(old);
+}
+
+static void map_insert(uint64_t key, void *ptr, size_t size) {
+    if ((used + 1) * 2 > capacity) {
+        map_grow();
+    }
+    size_t i = slot_hash(key);
+    while (slots[i].key > 1) {
+        i = (i + 1) & (capacity - 1);
+    }
+    if (slots[i].key == 0) {
+        ++used;
+    }
+    slots[i].key = key;
+    slots[i].ptr = ptr;
+    slots[i].size = size;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace.bin [sample-every] [heap.map]\n", argv[0]);
+        return 1;
+    }
+    long sampleEvery = argc > 2 ? atol(argv[2]) : 1024;
+    if (sampleEvery <= 0) {
+        sampleEvery = 1024;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    KuTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, KUTRACE_MAGIC, sizeof(header.magic)) != 0
+        || header.recordSize != sizeof(KuTraceRecord)) {
+        fprintf(stderr, "kureplay: %s is not a kutrace file\n", argv[1]);
+        return 1;
+    }
+    int mapFd = -1;
+    if (argc > 3) {
+        mapFd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mapFd < 0 || kuheapmap_begin(mapFd) != 0) {
+            perror(argv[3]);
+            return 1;
+        }
+    }
+    map_grow();
+    kumalloc_set_scavenge_interval(0);
+
+    static KuTraceRecord records[READ_BATCH];
+    uint64_t replayNs = 0;
+    uint64_t firstNs = 0;
+    long count = 0;
+    long unmatched = 0;
+    size_t live = 0;
+    size_t peakLive = 0;
+    size_t checkedLive = 0;
+    size_t peakFootprint = 0;
+    int threads = 0;
+    size_t got;
+
+    while ((got = fread(records, sizeof(KuTraceRecord), READ_BATCH, file)) > 0) {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < got; ++i) {
+            KuTraceRecord *rec = &records[i];
+            Slot *slot;
+            void *ptr;
+            if (rec->tid >= threads) {
+                threads = rec->tid + 1;
+            }
+            if (count == 0) {
+                firstNs = rec->ns;
+            }
+
+            switch (rec->op) {
+            case KUTRACE_MALLOC:
+            case KUTRACE_CALLOC:
+                if (rec->result == 0) {
+                    break;
+                }
+                ptr = rec->op == KUTRACE_MALLOC ? kumalloc(rec->size) : kucalloc(rec->size, 1);
+                map_insert(rec->result, ptr, rec->size);
+                live += rec->size;
+                break;
+            case KUTRACE_MEMALIGN:
+                if (rec->result == 0) {
+                    break;
+                }
+                ptr = kumemalign(rec->ptr, rec->size);
+                map_insert(rec->result, ptr, rec->size);
+                live += rec->size;
+                break;
+            case KUTRACE_REALLOC:
+                ptr = NULL;
+                slot = rec->ptr ? map_find(rec->ptr) : NULL;
+                if (slot == NULL && rec->ptr) {
+                    ++unmatched;  // allocated before tracing started
+                }
+                if (rec->result == 0 && rec->size != 0) {
+                    break;  // the traced realloc failed and kept the old block
+                }
+                if (slot) {
+                    ptr = slot->ptr;
+                    live -= slot->size;
+                    slot->key = 1;
+                }
+                ptr = kurealloc(ptr, rec->size);
+                if (rec->result) {
+                    map_insert(rec->result, ptr, rec->size);
+                    live += rec->size;
+                }
+                break;
+            case KUTRACE_FREE:
+                slot = map_find(rec->ptr);
+                if (slot == NULL) {
+                    ++unmatched;
+                    break;
+                }
+                kufree(slot->ptr);
+                live -= slot->size;
+                slot->key = 1;
+                break;
+            }
+            if (live > peakLive) {
+                peakLive = live;
+            }
+
+            // the footprint usually peaks with live bytes, look whenever they grew by 1/16
+            int sample = ++count % sampleEvery == 0;
+            if (sample || peakLive > checkedLive + checkedLive / 16) {
+                replayNs += now_ns() - start;
+                KuMallocStats stats;
+                kumalloc_stats(&stats);
+                size_t footprint = stats.heapBytes + stats.mmapBytes + stats.smallBytes + stats.nurseryBytes;
+                if (footprint > peakFootprint) {
+                    peakFootprint = footprint;
+                }
+                checkedLive = peakLive;
+                if (sample && mapFd >= 0 && kuheapmap_snapshot(mapFd, count) != 0) {
+                    perror(argv[3]);
+                    return 1;
+                }
+                start = now_ns();
+                if (!sample) {
+                    continue;
+                }
+                printf("{\"record\":%ld,\"trace_ms\":%.3f,\"live_bytes\":%zu,\"heap_bytes\":%zu,"
+                       "\"mmap_bytes\":%zu,\"free_bytes\":%zu,\"fragmentation\":%.4f}\n",
+                       count, (rec->ns - firstNs) / 1e6, live, stats.heapBytes,
+                       stats.mmapBytes, stats.bytesFree, stats.fragmentation);
+            }
+        }
+        replayNs += now_ns() - start;
+    }
+    fclose(file);
+    if (mapFd >= 0) {
+        kuheapmap_snapshot(mapFd, count);
+        close(mapFd);
+    }
+
+    KuMallocStats stats;
+    kumalloc_stats(&stats);
+    if (stats.heapBytes + stats.mmapBytes + stats.smallBytes + stats.nurseryBytes > peakFootprint) {
+        peakFootprint = stats.heapBytes + stats.mmapBytes + stats.smallBytes + stats.nurseryBytes;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"records\":%ld,\"threads\":%d,\"replay_ms\":%.3f,\"ns_per_record\":%.1f,"
+           "\"peak_live_bytes\":%zu,\"peak_footprint_bytes\":%zu,\"peak_rss_kb\":%ld,"
+           "\"fragmentation\":%.4f,\"unmatched\":%ld}\n",
+           count, threads, replayNs / 1e6, count ? (double)replayNs / count : 0.0,
+           peakLive, peakFootprint, usage.ru_maxrss, stats.fragmentation, unmatched);
+    return 0;
+}
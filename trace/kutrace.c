@@ -0,0 +1,222 @@
+/*
+ * LD_PRELOAD shim recording every malloc/calloc/realloc/free of a program,
+ * and the aligned posix_memalign/memalign/aligned_alloc.
+ *
+ *   LD_PRELOAD=./build/libkutrace.so ./shellect
+ *
+ * Calls are forwarded to glibc through its __libc_* entry points, which needs
+ * no dlsym and so cannot recurse into the shim while it is starting up. Each
+ * process writes <prefix>.<pid>.bin, the prefix comes from KUTRACE_FILE and
+ * defaults to "kutrace"; forked children start their own file.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "kutrace.h"
+
+#define TRACE_BUFFER 4096
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+#define THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+static KuTraceRecord buffer[TRACE_BUFFER];
+static size_t buffered;
+static int traceFd = -1;
+static int lock;
+static int finished;  // past our destructor, write every record straight away
+static uint16_t nextTid;
+
+static THREAD_LOCAL int threadTid = -1;
+static THREAD_LOCAL int recording;  // guards against anything below allocating
+
+static void trace_lock(void) {
+    while (__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void trace_unlock(void) {
+    __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+}
+
+static void write_all(const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t written = write(traceFd, ptr, len);
+        if (written <= 0) {
+            return;
+        }
+        ptr += written;
+        len -= written;
+    }
+}
+
+// called with the lock held
+static void trace_open(void) {
+    char path[4096];
+    const char *prefix = getenv("KUTRACE_FILE");
+    snprintf(path, sizeof(path), "%s.%d.bin", prefix ? prefix : "kutrace", (int)getpid());
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0) {
+        return;
+    }
+    KuTraceHeader header;
+    memcpy(header.magic, KUTRACE_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(KuTraceRecord);
+    header.pid = (uint32_t)getpid();
+    write_all(&header, sizeof(header));
+}
+
+static void trace_flush(void) {
+    if (traceFd >= 0 && buffered > 0) {
+        write_all(buffer, buffered * sizeof(KuTraceRecord));
+    }
+    buffered = 0;
+}
+
+/*
+ * The traced call runs under the lock, so no other thread can be handed a
+ * just-freed address before the free is recorded and the file order is the
+ * order in which the heap actually saw the calls.
+ */
+static int trace_begin(void) {
+    if (recording) {
+        return 0;
+    }
+    recording = 1;
+    trace_lock();
+    return 1;
+}
+
+static void trace_end(uint8_t op, void *result, void *ptr, size_t size) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    if (traceFd < 0) {
+        trace_open();
+    }
+    if (threadTid < 0) {
+        threadTid = nextTid++;
+    }
+    KuTraceRecord *rec = &buffer[buffered++];
+    rec->ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->result = (uintptr_t)result;
+    rec->ptr = (uintptr_t)ptr;
+    rec->size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    rec->tid = (uint16_t)threadTid;
+    rec->op = op;
+    rec->pad = 0;
+    if (buffered == TRACE_BUFFER || finished) {
+        trace_flush();
+    }
+
+    trace_unlock();
+    recording = 0;
+}
+
+void *malloc(size_t size) {
+    if (!trace_begin()) {
+        return __libc_malloc(size);
+    }
+    void *result = __libc_malloc(size);
+    trace_end(KUTRACE_MALLOC, result, NULL, size);
+    return result;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (!trace_begin()) {
+        return __libc_calloc(nmemb, size);
+    }
+    void *result = __libc_calloc(nmemb, size);
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        total = SIZE_MAX;
+    }
+    trace_end(KUTRACE_CALLOC, result, NULL, total);
+    return result;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!trace_begin()) {
+        return __libc_realloc(ptr, size);
+    }
+    void *result = __libc_realloc(ptr, size);
+    trace_end(KUTRACE_REALLOC, result, ptr, size);
+    return result;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || !trace_begin()) {
+        __libc_free(ptr);
+        return;
+    }
+    __libc_free(ptr);
+    trace_end(KUTRACE_FREE, NULL, ptr, 0);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (!trace_begin()) {
+        return __libc_memalign(alignment, size);
+    }
+    void *result = __libc_memalign(alignment, size);
+    trace_end(KUTRACE_MEMALIGN, result, (void *)alignment, size);
+    return result;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+// glibc exports no __libc_posix_memalign, check the arguments it would check
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void *result = memalign(alignment, size);
+    if (result == NULL) {
+        return ENOMEM;
+    }
+    *memptr = result;
+    return 0;
+}
+
+/*
+ * The child gets a copy of the parent's unwritten records; drop them (the
+ * parent writes its own) and let the first call open a file under the new pid.
+ */
+static void trace_prepare_fork(void) { trace_lock(); }
+static void trace_parent_fork(void) { trace_unlock(); }
+static void trace_child_fork(void) {
+    buffered = 0;
+    if (traceFd >= 0) {
+        close(traceFd);
+    }
+    traceFd = -1;
+    trace_unlock();
+}
+
+__attribute__((constructor))
+static void trace_init(void) {
+    pthread_atfork(trace_prepare_fork, trace_parent_fork, trace_child_fork);
+}
+
+// prioritised destructors run after the default ones, which may still free
+__attribute__((destructor(101)))
+static void trace_fini(void) {
+    trace_lock();
+    trace_flush();
+    finished = 1;
+    trace_unlock();
+}
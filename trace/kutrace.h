@@ -0,0 +1,40 @@
+#ifndef KUTRACE_H
+#define KUTRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary allocation trace written by libkutrace.so and read by kureplay.
+ *
+ * A file is one KuTraceHeader followed by KuTraceRecords in the order the
+ * calls completed (the recorder serialises them), so replaying the file
+ * front to back always performs the same sequence of calls.
+ */
+
+#define KUTRACE_MAGIC "KUTRACE1"
+
+enum {
+    KUTRACE_MALLOC = 1,
+    KUTRACE_CALLOC,
+    KUTRACE_REALLOC,
+    KUTRACE_FREE,
+    KUTRACE_MEMALIGN,  // posix_memalign, memalign or aligned_alloc
+};
+
+typedef struct KuTraceHeader {
+    char magic[8];
+    uint32_t recordSize;  // sizeof(KuTraceRecord) of the writer
+    uint32_t pid;
+} KuTraceHeader;
+
+typedef struct KuTraceRecord {
+    uint64_t ns;      // CLOCK_MONOTONIC when the call returned
+    uint64_t result;  // returned pointer, 0 for free
+    uint64_t ptr;     // pointer passed to realloc or free, the alignment for KUTRACE_MEMALIGN
+    uint32_t size;    // requested bytes, nmemb * size for calloc, saturates at 4 GiB
+    uint16_t tid;     // small per-process thread number, 0 is the first thread
+    uint8_t op;
+    uint8_t pad;
+} KuTraceRecord;
+
+#endif // KUTRACE_H